@@ -353,7 +353,7 @@ int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
 	CBlockIndex* pindex = chainActive[GetZerocoinStartHeight()];
 	int n = 0;
 	while (pindex->nHeight < nHeightEnd) {
-		n += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
+		n += pindex->mintDenominations.Count(denom);
 		pindex = chainActive.Next(pindex);
 	}
 
@@ -547,8 +547,7 @@ map<CoinDenomination, int> GetMintMaturityHeight()
 		for (auto denom : libzerocoin::zerocoinDenomList) {
 			//If the denom has not already had a mint added to it, then see if it has a mint added on this block
 			if (mapDenomMaturity.at(denom).first < Params().Zerocoin_RequiredAccumulation()) {
-				mapDenomMaturity.at(denom).first += count(pindex->vMintDenominationsInBlock.begin(),
-					pindex->vMintDenominationsInBlock.end(), denom);
+				mapDenomMaturity.at(denom).first += pindex->mintDenominations.Count(denom);
 
 				//if mint was found then record this block as the first block that maturity occurs.
 				if (mapDenomMaturity.at(denom).first >= Params().Zerocoin_RequiredAccumulation())
@@ -0,0 +1,114 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "sync.h"
+#include "util.h"
+
+#include <list>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedBlockFile::CMappedBlockFile(int nFileIn, const boost::filesystem::path& path) : pdata(NULL), nSize(0), nFile(nFileIn)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        LogPrintf("%s : unable to open %s\n", __func__, path.string());
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pdata = (const char*)p;
+            nSize = st.st_size;
+        } else {
+            LogPrintf("%s : unable to map %s\n", __func__, path.string());
+        }
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+#endif
+}
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    if (pdata)
+        munmap((void*)pdata, nSize);
+#endif
+}
+
+namespace
+{
+/** The mapped files, most recently used first */
+class CMappedBlockFilePool
+{
+private:
+    CCriticalSection cs;
+    std::list<boost::shared_ptr<const CMappedBlockFile> > listFiles;
+    unsigned int nLimit;
+
+    void Trim()
+    {
+        // Readers still holding an evicted file keep it mapped until they are done
+        while (listFiles.size() > nLimit)
+            listFiles.pop_back();
+    }
+
+public:
+    CMappedBlockFilePool() : nLimit(0) {}
+
+    void SetLimit(unsigned int nLimitIn)
+    {
+        LOCK(cs);
+        nLimit = nLimitIn;
+        Trim();
+    }
+
+    boost::shared_ptr<const CMappedBlockFile> Get(int nFile, const boost::filesystem::path& path)
+    {
+        LOCK(cs);
+        if (nLimit == 0)
+            return boost::shared_ptr<const CMappedBlockFile>();
+
+        for (std::list<boost::shared_ptr<const CMappedBlockFile> >::iterator it = listFiles.begin(); it != listFiles.end(); ++it) {
+            if ((*it)->nFile == nFile) {
+                listFiles.splice(listFiles.begin(), listFiles, it);
+                return listFiles.front();
+            }
+        }
+
+        boost::shared_ptr<const CMappedBlockFile> pfile(new CMappedBlockFile(nFile, path));
+        if (pfile->IsNull())
+            return boost::shared_ptr<const CMappedBlockFile>();
+        LogPrint("db", "%s : mapped %s\n", __func__, path.string());
+        listFiles.push_front(pfile);
+        Trim();
+        return pfile;
+    }
+};
+
+CMappedBlockFilePool mappedBlockFiles;
+} // anon namespace
+
+void SetMappedBlockFileLimit(unsigned int nLimit)
+{
+#ifdef WIN32
+    nLimit = 0;
+#endif
+    mappedBlockFiles.SetLimit(nLimit);
+}
+
+boost::shared_ptr<const CMappedBlockFile> GetMappedBlockFile(int nFile, const boost::filesystem::path& path)
+{
+    return mappedBlockFiles.Get(nFile, path);
+}
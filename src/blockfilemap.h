@@ -0,0 +1,53 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef Dequant_BLOCKFILEMAP_H
+#define Dequant_BLOCKFILEMAP_H
+
+#include <stddef.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+/** Default for -mapblockfiles, the number of finalized block files kept mapped for reading */
+static const unsigned int DEFAULT_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 8 : 0;
+
+/**
+ * A block file mapped read-only into memory. Only files that are no longer
+ * appended to may be mapped; the mapping covers the file as it was when mapped.
+ */
+class CMappedBlockFile
+{
+private:
+    // Disallow copies
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+
+    const char* pdata;
+    size_t nSize;
+
+public:
+    const int nFile;
+
+    CMappedBlockFile(int nFileIn, const boost::filesystem::path& path);
+    ~CMappedBlockFile();
+
+    bool IsNull() const { return pdata == NULL; }
+
+    /** The nLength bytes at nPos, or NULL unless they are all within the file */
+    const char* GetRange(size_t nPos, size_t nLength) const
+    {
+        if (pdata == NULL || nPos > nSize || nLength > nSize - nPos)
+            return NULL;
+        return pdata + nPos;
+    }
+};
+
+/** Set how many files may be mapped at once, unmapping the least recently used ones. 0 disables mapping. */
+void SetMappedBlockFileLimit(unsigned int nLimit);
+
+/** The mapped block file nFile, mapping it if needed. NULL if mapping is disabled or failed. */
+boost::shared_ptr<const CMappedBlockFile> GetMappedBlockFile(int nFile, const boost::filesystem::path& path);
+
+#endif //Dequant_BLOCKFILEMAP_H
@@ -7,8 +7,32 @@
 
 #include "chain.h"
 
+#include "sync.h"
+
+#include <set>
+
 using namespace std;
 
+namespace
+{
+CCriticalSection cs_internedHashes;
+set<uint256> setInternedHashes;
+} // anon namespace
+
+const uint256* CInternedHash::Intern(const uint256& hash)
+{
+    if (hash == 0)
+        return NULL;
+    LOCK(cs_internedHashes);
+    return &*setInternedHashes.insert(hash).first;
+}
+
+size_t CInternedHash::GetPoolSize()
+{
+    LOCK(cs_internedHashes);
+    return setInternedHashes.size();
+}
+
 /**
  * CChain implementation
  */
@@ -62,20 +86,3 @@ const CBlockIndex* CChain::FindFork(const CBlockIndex* pindex) const
         pindex = pindex->pprev;
     return pindex;
 }
-
-uint256 CBlockIndex::GetBlockTrust() const
-{
-    uint256 bnTarget;
-    bnTarget.SetCompact(nBits);
-    if (bnTarget <= 0)
-        return 0;
-
-    if (IsProofOfStake()) {
-        // Return trust score as usual
-        return (uint256(1) << 256) / (bnTarget + 1);
-    } else {
-        // Calculate work amount for block
-        uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
-        return bnPoWTrust > 1 ? bnPoWTrust : 1;
-    }
-}
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <stdexcept>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -63,6 +64,158 @@ struct CDiskBlockPos {
     bool IsNull() const { return (nFile == -1); }
 };
 
+//! Number of denominations in libzerocoin::zerocoinDenomList
+static const size_t ZEROCOIN_DENOMINATIONS = 8;
+
+//! Position of a denomination in libzerocoin::zerocoinDenomList
+inline size_t GetZerocoinDenominationIndex(libzerocoin::CoinDenomination denom)
+{
+    switch (denom) {
+    case libzerocoin::ZQ_ONE: return 0;
+    case libzerocoin::ZQ_FIVE: return 1;
+    case libzerocoin::ZQ_TEN: return 2;
+    case libzerocoin::ZQ_FIFTY: return 3;
+    case libzerocoin::ZQ_ONE_HUNDRED: return 4;
+    case libzerocoin::ZQ_FIVE_HUNDRED: return 5;
+    case libzerocoin::ZQ_ONE_THOUSAND: return 6;
+    case libzerocoin::ZQ_FIVE_THOUSAND: return 7;
+    default: throw std::out_of_range("GetZerocoinDenominationIndex() : invalid denomination");
+    }
+}
+
+/** Zerocoin supply of every denomination. Serialized as the map it replaced. */
+class CZerocoinSupply
+{
+private:
+    int64_t anSupply[ZEROCOIN_DENOMINATIONS];
+
+public:
+    CZerocoinSupply()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        std::fill(anSupply, anSupply + ZEROCOIN_DENOMINATIONS, 0);
+    }
+
+    int64_t& at(libzerocoin::CoinDenomination denom) { return anSupply[GetZerocoinDenominationIndex(denom)]; }
+    const int64_t& at(libzerocoin::CoinDenomination denom) const { return anSupply[GetZerocoinDenominationIndex(denom)]; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        std::map<libzerocoin::CoinDenomination, int64_t> mapSupply;
+        if (!ser_action.ForRead()) {
+            for (size_t i = 0; i < ZEROCOIN_DENOMINATIONS; i++)
+                mapSupply.insert(std::make_pair(libzerocoin::zerocoinDenomList[i], anSupply[i]));
+        }
+        READWRITE(mapSupply);
+        if (ser_action.ForRead()) {
+            SetNull();
+            for (const std::pair<const libzerocoin::CoinDenomination, int64_t>& supply : mapSupply)
+                at(supply.first) = supply.second;
+        }
+    }
+};
+
+/** Number of mints of every denomination in a block. Serialized as the list of denominations it replaced. */
+class CMintDenominations
+{
+private:
+    uint16_t anMints[ZEROCOIN_DENOMINATIONS];
+
+public:
+    CMintDenominations()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        std::fill(anMints, anMints + ZEROCOIN_DENOMINATIONS, 0);
+    }
+
+    void Add(libzerocoin::CoinDenomination denom) { anMints[GetZerocoinDenominationIndex(denom)]++; }
+    int Count(libzerocoin::CoinDenomination denom) const { return anMints[GetZerocoinDenominationIndex(denom)]; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        std::vector<libzerocoin::CoinDenomination> vDenoms;
+        if (!ser_action.ForRead()) {
+            for (size_t i = 0; i < ZEROCOIN_DENOMINATIONS; i++)
+                vDenoms.insert(vDenoms.end(), anMints[i], libzerocoin::zerocoinDenomList[i]);
+        }
+        READWRITE(vDenoms);
+        if (ser_action.ForRead()) {
+            SetNull();
+            for (libzerocoin::CoinDenomination denom : vDenoms)
+                Add(denom);
+        }
+    }
+};
+
+/**
+ * A hash shared by many block index entries, such as the accumulator checkpoint that stays
+ * the same for ten blocks at a time. Every distinct value is stored once in a pool that lives
+ * as long as the process and the entries only point to it.
+ */
+class CInternedHash
+{
+private:
+    const uint256* phash; //! NULL for zero
+
+    static const uint256* Intern(const uint256& hash);
+
+public:
+    CInternedHash() : phash(NULL) {}
+    CInternedHash(const uint256& hash) : phash(Intern(hash)) {}
+
+    const uint256& Get() const
+    {
+        static const uint256 hashZero;
+        return phash ? *phash : hashZero;
+    }
+
+    operator const uint256&() const { return Get(); }
+    std::string GetHex() const { return Get().GetHex(); }
+
+    friend bool operator==(const CInternedHash& a, const CInternedHash& b) { return a.phash == b.phash; }
+    friend bool operator!=(const CInternedHash& a, const CInternedHash& b) { return a.phash != b.phash; }
+    friend bool operator==(const CInternedHash& a, const uint256& b) { return a.Get() == b; }
+    friend bool operator!=(const CInternedHash& a, const uint256& b) { return a.Get() != b; }
+    friend bool operator==(const uint256& a, const CInternedHash& b) { return a == b.Get(); }
+    friend bool operator!=(const uint256& a, const CInternedHash& b) { return a != b.Get(); }
+
+    //! Number of distinct hashes in the pool
+    static size_t GetPoolSize();
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return ::GetSerializeSize(Get(), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, Get(), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        uint256 hash;
+        ::Unserialize(s, hash, nType, nVersion);
+        phash = Intern(hash);
+    }
+};
+
 enum BlockStatus {
     //! Unused.
     BLOCK_VALID_UNKNOWN = 0,
@@ -100,6 +253,8 @@ enum BlockStatus {
     BLOCK_FAILED_VALID = 32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD = 64, //! descends from failed block
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_HASH_VERIFIED = 128, //! the entry is stored under the hash of its own header
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -122,9 +277,6 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
-    //ppcoin: trust score of block chain
-    uint256 bnChainTrust;
-
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -160,12 +312,10 @@ public:
     };
 
     // proof-of-stake specific fields
-    uint256 GetBlockTrust() const;
     uint64_t nStakeModifier;             // hash modifier for proof-of-stake
     unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
     COutPoint prevoutStake;
     unsigned int nStakeTime;
-    uint256 hashProofOfStake;
     int64_t nMint;
     int64_t nMoneySupply;
 
@@ -175,14 +325,14 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     unsigned int nNonce;
-    uint256 nAccumulatorCheckpoint;
+    CInternedHash nAccumulatorCheckpoint;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
     
     //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
-    std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    CZerocoinSupply zerocoinSupply;
+    CMintDenominations mintDenominations;
     
     void SetNull()
     {
@@ -212,12 +362,9 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
-        nAccumulatorCheckpoint = 0;
-        // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(make_pair(denom, 0));
-        }
-        vMintDenominationsInBlock.clear();
+        nAccumulatorCheckpoint = CInternedHash();
+        zerocoinSupply.SetNull();
+        mintDenominations.SetNull();
     }
 
     CBlockIndex()
@@ -238,13 +385,11 @@ public:
             nAccumulatorCheckpoint = block.nAccumulatorCheckpoint;
 
         //Proof of Stake
-        bnChainTrust = uint256();
         nMint = 0;
         nMoneySupply = 0;
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
-        hashProofOfStake = uint256();
 
         if (block.IsProofOfStake()) {
             SetProofOfStake();
@@ -295,14 +440,14 @@ public:
     {
         int64_t nTotal = 0;
         for (auto& denom : libzerocoin::zerocoinDenomList) {
-            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * mapZerocoinSupply.at(denom);
+            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * zerocoinSupply.at(denom);
         }
         return nTotal;
     }
 
     bool MintedDenomination(libzerocoin::CoinDenomination denom) const
     {
-        return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
+        return mintDenominations.Count(denom) > 0;
     }
 
     uint256 GetBlockHash() const
@@ -468,7 +613,6 @@ public:
         } else {
             const_cast<CDiskBlockIndex*>(this)->prevoutStake.SetNull();
             const_cast<CDiskBlockIndex*>(this)->nStakeTime = 0;
-            const_cast<CDiskBlockIndex*>(this)->hashProofOfStake = uint256();
         }
 
         // block header
@@ -481,13 +625,22 @@ public:
         READWRITE(nNonce);
         if(this->nVersion > 3) {
             READWRITE(nAccumulatorCheckpoint);
-            READWRITE(mapZerocoinSupply);
-            READWRITE(vMintDenominationsInBlock);
+            READWRITE(zerocoinSupply);
+            READWRITE(mintDenominations);
         }
 
     }
 
     uint256 GetBlockHash() const
+    {
+        // Entries built from an in-memory index already know their hash
+        if (phashBlock)
+            return *phashBlock;
+        return GetHeaderHash();
+    }
+
+    //! Hash the header fields, which is expensive for Quark headers
+    uint256 GetHeaderHash() const
     {
         CBlockHeader block;
         block.nVersion = nVersion;
@@ -197,7 +197,7 @@ public:
         fMineBlocksOnDemand = false;
         fSkipProofOfWorkCheck = false;
         fTestnetToBeDeprecatedFieldRPC = false;
-        fHeadersFirstSyncingActive = false;
+        fHeadersFirstSyncingActive = true;
 
         nPoolMaxTransactions = 3;
         strSporkKey = "041ecbc5ac6d4aacd43f3d635ed306017b04b2a9b93c57ae3a02e6675529026f231857ddc2b3a2c77c5cb422b35869f00a7c293deca4454851761436457dc2d527";
@@ -0,0 +1,76 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/dequant-config.h"
+#endif
+
+#ifdef ENABLE_AVX2
+
+#include "crypto/sha256_multiway.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace sha256d64_avx2
+{
+namespace
+{
+uint32_t inline ReadWord(const unsigned char* ptr)
+{
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+void inline WriteWord(unsigned char* ptr, uint32_t x)
+{
+    ptr[0] = x >> 24;
+    ptr[1] = x >> 16;
+    ptr[2] = x >> 8;
+    ptr[3] = x;
+}
+
+/** Eight lanes of AVX2 */
+struct Vec8
+{
+    typedef __m256i Vec;
+
+    static Vec K(uint32_t x) { return _mm256_set1_epi32(x); }
+    static Vec Add(Vec x, Vec y) { return _mm256_add_epi32(x, y); }
+    static Vec Xor(Vec x, Vec y) { return _mm256_xor_si256(x, y); }
+    static Vec And(Vec x, Vec y) { return _mm256_and_si256(x, y); }
+    static Vec Or(Vec x, Vec y) { return _mm256_or_si256(x, y); }
+    static Vec ShR(Vec x, int n) { return _mm256_srli_epi32(x, n); }
+    static Vec ShL(Vec x, int n) { return _mm256_slli_epi32(x, n); }
+
+    static Vec Load(const unsigned char* in, int i)
+    {
+        in += 4 * i;
+        return _mm256_set_epi32(ReadWord(in + 448), ReadWord(in + 384), ReadWord(in + 320), ReadWord(in + 256),
+                                ReadWord(in + 192), ReadWord(in + 128), ReadWord(in + 64), ReadWord(in));
+    }
+
+    static void Store(unsigned char* out, int i, Vec x)
+    {
+        out += 4 * i;
+        WriteWord(out, _mm256_extract_epi32(x, 0));
+        WriteWord(out + 32, _mm256_extract_epi32(x, 1));
+        WriteWord(out + 64, _mm256_extract_epi32(x, 2));
+        WriteWord(out + 96, _mm256_extract_epi32(x, 3));
+        WriteWord(out + 128, _mm256_extract_epi32(x, 4));
+        WriteWord(out + 160, _mm256_extract_epi32(x, 5));
+        WriteWord(out + 192, _mm256_extract_epi32(x, 6));
+        WriteWord(out + 224, _mm256_extract_epi32(x, 7));
+    }
+};
+
+} // namespace
+
+void TransformD64_8way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::TransformD64<Vec8>(out, in);
+}
+
+} // namespace sha256d64_avx2
+
+#endif
@@ -0,0 +1,122 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+#define BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+
+#include <stdint.h>
+
+/**
+ * Double-SHA256 of several 64-byte inputs at once, one input per 32-bit lane of a
+ * vector register.
+ *
+ * Only included by the translation units that are compiled for the instruction set
+ * of the vector type. That type, and any helper it uses instead of crypto/common.h,
+ * has to live in an anonymous namespace there, so code generated for the instruction
+ * set can never be picked by the linker for a caller on another CPU. It provides:
+ *   Vec                 the vector type
+ *   K(x)                x in every lane
+ *   Add, Xor, And, Or   lane-wise operations
+ *   ShR(x, n), ShL      lane-wise shifts
+ *   Load(in, i)         word i (big endian) of the input of every lane, lane n at in + 64 * n
+ *   Store(out, i, x)    word i (big endian) of the output of every lane, lane n at out + 32 * n
+ */
+namespace sha256_multiway
+{
+static const uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t INITIAL_STATE[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+template <typename V>
+inline typename V::Vec Ch(typename V::Vec x, typename V::Vec y, typename V::Vec z) { return V::Xor(z, V::And(x, V::Xor(y, z))); }
+template <typename V>
+inline typename V::Vec Maj(typename V::Vec x, typename V::Vec y, typename V::Vec z) { return V::Or(V::And(x, y), V::And(z, V::Or(x, y))); }
+template <typename V>
+inline typename V::Vec Rotr(typename V::Vec x, int n) { return V::Or(V::ShR(x, n), V::ShL(x, 32 - n)); }
+template <typename V>
+inline typename V::Vec Sigma0(typename V::Vec x) { return V::Xor(V::Xor(Rotr<V>(x, 2), Rotr<V>(x, 13)), Rotr<V>(x, 22)); }
+template <typename V>
+inline typename V::Vec Sigma1(typename V::Vec x) { return V::Xor(V::Xor(Rotr<V>(x, 6), Rotr<V>(x, 11)), Rotr<V>(x, 25)); }
+template <typename V>
+inline typename V::Vec sigma0(typename V::Vec x) { return V::Xor(V::Xor(Rotr<V>(x, 7), Rotr<V>(x, 18)), V::ShR(x, 3)); }
+template <typename V>
+inline typename V::Vec sigma1(typename V::Vec x) { return V::Xor(V::Xor(Rotr<V>(x, 17), Rotr<V>(x, 19)), V::ShR(x, 10)); }
+
+/** One SHA-256 transformation of the message words w, added into the state s. w is clobbered. */
+template <typename V>
+inline void Transform(typename V::Vec* s, typename V::Vec* w)
+{
+    typedef typename V::Vec Vec;
+    Vec a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = V::Add(V::Add(w[i & 15], sigma0<V>(w[(i + 1) & 15])), V::Add(w[(i + 9) & 15], sigma1<V>(w[(i + 14) & 15])));
+        Vec t1 = V::Add(V::Add(h, Sigma1<V>(e)), V::Add(Ch<V>(e, f, g), V::Add(V::K(ROUND_CONSTANTS[i]), w[i & 15])));
+        Vec t2 = V::Add(Sigma0<V>(a), Maj<V>(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = V::Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = V::Add(t1, t2);
+    }
+    s[0] = V::Add(s[0], a);
+    s[1] = V::Add(s[1], b);
+    s[2] = V::Add(s[2], c);
+    s[3] = V::Add(s[3], d);
+    s[4] = V::Add(s[4], e);
+    s[5] = V::Add(s[5], f);
+    s[6] = V::Add(s[6], g);
+    s[7] = V::Add(s[7], h);
+}
+
+/** Double-SHA256 of one 64-byte input per lane. */
+template <typename V>
+inline void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    typedef typename V::Vec Vec;
+    Vec s[8], w[16];
+
+    for (int i = 0; i < 8; i++)
+        s[i] = V::K(INITIAL_STATE[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = V::Load(in, i);
+    Transform<V>(s, w);
+
+    // The padding block of a 64-byte message
+    w[0] = V::K(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = V::K(0);
+    w[15] = V::K(512);
+    Transform<V>(s, w);
+
+    // Hash the 32-byte result again
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        s[i] = V::K(INITIAL_STATE[i]);
+    }
+    w[8] = V::K(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = V::K(0);
+    w[15] = V::K(256);
+    Transform<V>(s, w);
+
+    for (int i = 0; i < 8; i++)
+        V::Store(out, i, s[i]);
+}
+
+} // namespace sha256_multiway
+
+#endif // BITCOIN_CRYPTO_SHA256_MULTIWAY_H
@@ -0,0 +1,71 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/dequant-config.h"
+#endif
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/sha256_multiway.h"
+
+#include <stdint.h>
+#include <smmintrin.h>
+
+namespace sha256d64_sse41
+{
+namespace
+{
+uint32_t inline ReadWord(const unsigned char* ptr)
+{
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+void inline WriteWord(unsigned char* ptr, uint32_t x)
+{
+    ptr[0] = x >> 24;
+    ptr[1] = x >> 16;
+    ptr[2] = x >> 8;
+    ptr[3] = x;
+}
+
+/** Four lanes of SSE4.1 */
+struct Vec4
+{
+    typedef __m128i Vec;
+
+    static Vec K(uint32_t x) { return _mm_set1_epi32(x); }
+    static Vec Add(Vec x, Vec y) { return _mm_add_epi32(x, y); }
+    static Vec Xor(Vec x, Vec y) { return _mm_xor_si128(x, y); }
+    static Vec And(Vec x, Vec y) { return _mm_and_si128(x, y); }
+    static Vec Or(Vec x, Vec y) { return _mm_or_si128(x, y); }
+    static Vec ShR(Vec x, int n) { return _mm_srli_epi32(x, n); }
+    static Vec ShL(Vec x, int n) { return _mm_slli_epi32(x, n); }
+
+    static Vec Load(const unsigned char* in, int i)
+    {
+        in += 4 * i;
+        return _mm_set_epi32(ReadWord(in + 192), ReadWord(in + 128), ReadWord(in + 64), ReadWord(in));
+    }
+
+    static void Store(unsigned char* out, int i, Vec x)
+    {
+        out += 4 * i;
+        WriteWord(out, _mm_extract_epi32(x, 0));
+        WriteWord(out + 32, _mm_extract_epi32(x, 1));
+        WriteWord(out + 64, _mm_extract_epi32(x, 2));
+        WriteWord(out + 96, _mm_extract_epi32(x, 3));
+    }
+};
+
+} // namespace
+
+void TransformD64_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::TransformD64<Vec4>(out, in);
+}
+
+} // namespace sha256d64_sse41
+
+#endif
@@ -6,9 +6,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
+#include <atomic>
+#include <list>
+
+#include "crypto/common.h"
 #include "db.h"
+#include "init.h"
 #include "kernel.h"
 #include "script/interpreter.h"
 #include "timedata.h"
@@ -245,9 +252,118 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
+namespace {
+/**
+ * Results of GetKernelStakeModifier() by hash of the block from, least recently used evicted first.
+ * A result only depends on the blocks up to the one its modifier is read from, so it stays valid
+ * for as long as that block is in the active chain.
+ */
+class CStakeModifierCache
+{
+private:
+    struct Entry {
+        uint256 hashBlockFrom;
+        uint64_t nStakeModifier;
+        int nHeight;
+        int64_t nTime;
+        const CBlockIndex* pindexModifier;
+    };
+    typedef std::list<Entry> EntryList;
+
+    CCriticalSection cs;
+    EntryList listEntries; // most recently used first
+    std::map<uint256, EntryList::iterator> mapEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Erase(std::map<uint256, EntryList::iterator>::iterator it)
+    {
+        listEntries.erase(it->second);
+        mapEntries.erase(it);
+    }
+
+public:
+    CStakeModifierCache() : nHits(0), nMisses(0) {}
+
+    bool Get(const uint256& hashBlockFrom, uint64_t& nStakeModifier, int& nHeight, int64_t& nTime)
+    {
+        LOCK(cs);
+        std::map<uint256, EntryList::iterator>::iterator it = mapEntries.find(hashBlockFrom);
+        if (it != mapEntries.end() && !chainActive.Contains(it->second->pindexModifier)) {
+            // The tip moved below the modifier without going through DisconnectTip()
+            Erase(it);
+            it = mapEntries.end();
+        }
+        if (it == mapEntries.end()) {
+            nMisses++;
+            return false;
+        }
+
+        listEntries.splice(listEntries.begin(), listEntries, it->second);
+        nStakeModifier = it->second->nStakeModifier;
+        nHeight = it->second->nHeight;
+        nTime = it->second->nTime;
+        nHits++;
+        return true;
+    }
+
+    void Add(const uint256& hashBlockFrom, uint64_t nStakeModifier, int nHeight, int64_t nTime, const CBlockIndex* pindexModifier)
+    {
+        LOCK(cs);
+        if (mapEntries.count(hashBlockFrom))
+            return;
+
+        Entry entry = {hashBlockFrom, nStakeModifier, nHeight, nTime, pindexModifier};
+        listEntries.push_front(entry);
+        mapEntries.insert(std::make_pair(hashBlockFrom, listEntries.begin()));
+        while (mapEntries.size() > MAX_STAKE_MODIFIER_CACHE_SIZE) {
+            mapEntries.erase(listEntries.back().hashBlockFrom);
+            listEntries.pop_back();
+        }
+    }
+
+    void Invalidate(int nHeight)
+    {
+        LOCK(cs);
+        std::map<uint256, EntryList::iterator>::iterator it = mapEntries.begin();
+        while (it != mapEntries.end()) {
+            if (it->second->pindexModifier->nHeight >= nHeight)
+                Erase(it++);
+            else
+                ++it;
+        }
+    }
+
+    StakeModifierCacheStats GetStats()
+    {
+        LOCK(cs);
+        StakeModifierCacheStats stats;
+        stats.nSize = mapEntries.size();
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        return stats;
+    }
+};
+
+CStakeModifierCache stakeModifierCache;
+} // anon namespace
+
+void InvalidateStakeModifierCache(int nHeight)
+{
+    stakeModifierCache.Invalidate(nHeight);
+}
+
+StakeModifierCacheStats GetStakeModifierCacheStats()
+{
+    return stakeModifierCache.GetStats();
+}
+
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
+    if (stakeModifierCache.Get(hashBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime))
+        return true;
+
     if (!mapBlockIndex.count(hashBlockFrom))
         return error("GetKernelStakeModifier() : block not indexed");
     const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
@@ -272,6 +388,7 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+    stakeModifierCache.Add(hashBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, pindex);
     return true;
 }
 
@@ -296,52 +413,141 @@ bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t
     return stakeTargetHit(hashProofOfStake, nValueIn, bnTarget);
 }
 
-bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake)
+bool CStakeKernelInput::SetInput(CStakeInput* stakeInput, unsigned int nTimeBlockFromIn)
 {
-    if (nTimeTx < nTimeBlockFrom)
-        return error("CheckStakeKernelHash() : nTime violation");
+    uint64_t nStakeModifier = 0;
+    if (!stakeInput->GetModifier(nStakeModifier))
+        return error("%s : failed to get kernel stake modifier", __func__);
 
-    if (nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
-        return error("CheckStakeKernelHash() : min age violation - nTimeBlockFrom=%d nStakeMinAge=%d nTimeTx=%d",
-                     nTimeBlockFrom, nStakeMinAge, nTimeTx);
+    nTimeBlockFrom = nTimeBlockFromIn;
+    nValueIn = stakeInput->GetValue();
 
-    //grab difficulty
-    uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+    // Same serialization as CheckStake(), minus the trailing nTimeTx
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier << nTimeBlockFrom << stakeInput->GetUniqueness();
+    hasherPrefix.Reset();
+    hasherPrefix.Write((const unsigned char*)&ss[0], ss.size());
+    return true;
+}
 
-    //grab stake modifier
-    uint64_t nStakeModifier = 0;
-    if (!stakeInput->GetModifier(nStakeModifier))
-        return error("failed to get kernel stake modifier");
+uint256 CStakeKernelInput::GetHashProofOfStake(unsigned int nTimeTx) const
+{
+    unsigned char vchTime[4];
+    WriteLE32(vchTime, nTimeTx);
+
+    uint256 hashProofOfStake;
+    CHash256 hasher(hasherPrefix);
+    hasher.Write(vchTime, sizeof(vchTime)).Finalize((unsigned char*)&hashProofOfStake);
+    return hashProofOfStake;
+}
+
+bool CStakeKernelInput::Search(const uint256& bnTargetPerCoinDay, unsigned int nTimeTx, unsigned int& nTimeTxFound, uint256& hashProofOfStake) const
+{
+    if (nTimeTx < nTimeBlockFrom || nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
+        return false;
 
-    bool fSuccess = false;
-    unsigned int nTryTime = 0;
-    int nHeightStart = chainActive.Height();
     int nHashDrift = 30;
-    CDataStream ssUniqueID = stakeInput->GetUniqueness();
-    CAmount nValueIn = stakeInput->GetValue();
     for (int i = 0; i < nHashDrift; i++) //iterate the hashing
     {
-        //new block came in, move on
-        if (chainActive.Height() != nHeightStart)
-            break;
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
+        uint256 hash = GetHashProofOfStake(nTryTime);
+        if (stakeTargetHit(hash, nValueIn, bnTargetPerCoinDay)) {
+            nTimeTxFound = nTryTime;
+            hashProofOfStake = hash;
+            return true;
+        }
+    }
+    return false;
+}
 
-        //hash this iteration
-        nTryTime = nTimeTx + nHashDrift - i;
+namespace {
 
-        // if stake hash does not meet the target then continue to next iteration
-        if (!CheckStake(ssUniqueID, nValueIn, nStakeModifier, bnTargetPerCoinDay, nTimeBlockFrom, nTryTime, hashProofOfStake))
-            continue;
+// State shared by the threads of one kernel search. Inputs are handed out in order and
+// the lowest index that hits is kept, so the result matches a serial search.
+class CStakeKernelSearch
+{
+private:
+    const std::vector<CStakeKernelInput>& vInputs;
+    const uint256 bnTargetPerCoinDay;
+    const unsigned int nTimeTx;
+    const int nHeightStart;
+    std::atomic<size_t> nNext;
+    std::atomic<size_t> nBest;
+    std::atomic<bool> fCancelled;
+    boost::mutex cs;
+    unsigned int nTimeTxBest;
+    uint256 hashBest;
+
+public:
+    CStakeKernelSearch(const std::vector<CStakeKernelInput>& vInputsIn, size_t nStart, const uint256& bnTargetIn, unsigned int nTimeTxIn)
+        : vInputs(vInputsIn), bnTargetPerCoinDay(bnTargetIn), nTimeTx(nTimeTxIn), nHeightStart(chainActive.Height()),
+          nNext(nStart), nBest(vInputsIn.size()), fCancelled(false), nTimeTxBest(0), hashBest(0) {}
+
+    void Work()
+    {
+        while (!fCancelled) {
+            size_t i = nNext++;
+            if (i >= nBest)
+                return;
+
+            //new block came in, move on
+            if (chainActive.Height() != nHeightStart || ShutdownRequested()) {
+                fCancelled = true;
+                return;
+            }
+
+            unsigned int nTimeTxFound = 0;
+            uint256 hashProofOfStake = 0;
+            if (!vInputs[i].Search(bnTargetPerCoinDay, nTimeTx, nTimeTxFound, hashProofOfStake))
+                continue;
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (i < nBest) {
+                nBest = i;
+                nTimeTxBest = nTimeTxFound;
+                hashBest = hashProofOfStake;
+            }
+        }
+    }
 
-        fSuccess = true; // if we make it this far then we have successfully created a stake hash
-        //LogPrintf("%s: hashproof=%s\n", __func__, hashProofOfStake.GetHex());
-        nTimeTx = nTryTime;
-        break;
+    bool GetResult(size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake)
+    {
+        if (fCancelled || nBest == vInputs.size())
+            return false;
+        nFound = nBest;
+        nTimeTxFound = nTimeTxBest;
+        hashProofOfStake = hashBest;
+        return true;
     }
+};
+
+} // anon namespace
+
+bool FindStakeKernel(const std::vector<CStakeKernelInput>& vInputs, size_t nStart, unsigned int nBits, unsigned int nTimeTx,
+                     size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake)
+{
+    //grab difficulty
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    // -stakethreads=0 means one thread per core, the calling thread included
+    int nThreads = GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+    if (nThreads <= 0)
+        nThreads += boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_STAKE_THREADS));
+    if (nStart < vInputs.size())
+        nThreads = std::min<size_t>(nThreads, vInputs.size() - nStart);
+
+    CStakeKernelSearch search(vInputs, nStart, bnTargetPerCoinDay, nTimeTx);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CStakeKernelSearch::Work, &search));
+    search.Work();
+    threadGroup.join_all();
 
     mapHashedBlocks.clear();
     mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
-    return fSuccess;
+    return search.GetResult(nFound, nTimeTxFound, hashProofOfStake);
 }
 
 // Check kernel hash target and coinstake signature
@@ -412,14 +618,14 @@ bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx)
 }
 
 // Get stake modifier checksum
-unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex)
+unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex, const uint256& hashProofOfStake)
 {
     assert(pindex->pprev || pindex->GetBlockHash() == Params().HashGenesisBlock());
     // Hash previous checksum with flags, hashProofOfStake and nStakeModifier
     CDataStream ss(SER_GETHASH, 0);
     if (pindex->pprev)
         ss << pindex->pprev->nStakeModifierChecksum;
-    ss << pindex->nFlags << pindex->hashProofOfStake << pindex->nStakeModifier;
+    ss << pindex->nFlags << hashProofOfStake << pindex->nStakeModifier;
     uint256 hashChecksum = Hash(ss.begin(), ss.end());
     hashChecksum >>= (256 - 32);
     return hashChecksum.Get64();
@@ -7,6 +7,7 @@
 #ifndef BITCOIN_KERNEL_H
 #define BITCOIN_KERNEL_H
 
+#include "hash.h"
 #include "main.h"
 #include "stakeinput.h"
 
@@ -21,13 +22,51 @@ extern unsigned int getIntervalVersion(bool fTestNet);
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+// -stakethreads default (0 = one per core) and upper limit for the kernel search
+static const int DEFAULT_STAKE_THREADS = 0;
+static const int MAX_STAKE_THREADS = 16;
+
+// Data of one stake input that is the same for every hashed timestamp, so that the kernel
+// search only hashes the timestamp on top of a precomputed prefix
+class CStakeKernelInput
+{
+private:
+    CHash256 hasherPrefix; // fed with stake modifier, nTimeBlockFrom and input uniqueness
+    CAmount nValueIn;
+    unsigned int nTimeBlockFrom;
+
+public:
+    CStakeKernelInput() : nValueIn(0), nTimeBlockFrom(0) {}
+
+    bool SetInput(CStakeInput* stakeInput, unsigned int nTimeBlockFromIn);
+    unsigned int GetTimeBlockFrom() const { return nTimeBlockFrom; }
+    uint256 GetHashProofOfStake(unsigned int nTimeTx) const;
+    bool Search(const uint256& bnTargetPerCoinDay, unsigned int nTimeTx, unsigned int& nTimeTxFound, uint256& hashProofOfStake) const;
+};
+
+// Number of GetKernelStakeModifier() results kept, keyed by block from
+static const unsigned int MAX_STAKE_MODIFIER_CACHE_SIZE = 20000;
+
+// Lookup statistics of the stake modifier cache
+struct StakeModifierCacheStats {
+    uint64_t nSize;
+    uint64_t nHits;
+    uint64_t nMisses;
+};
+
 // Compute the hash modifier for proof-of-stake
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
+// Forget cached stake modifiers that were read from blocks at or above nHeight, called when the tip is disconnected
+void InvalidateStakeModifierCache(int nHeight);
+StakeModifierCacheStats GetStakeModifierCacheStats();
 
 bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t nStakeModifier, const uint256& bnTarget, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake);
+// Find the first input from vInputs[nStart] on whose kernel meets the target around nTimeTx.
+// The inputs are spread over -stakethreads threads and the search stops when a new block arrives.
+bool FindStakeKernel(const std::vector<CStakeKernelInput>& vInputs, size_t nStart, unsigned int nBits, unsigned int nTimeTx,
+                     size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
@@ -37,7 +76,7 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
 bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
 
 // Get stake modifier checksum
-unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex);
+unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex, const uint256& hashProofOfStake);
 
 // Check stake modifier hard checkpoints
 bool CheckStakeModifierCheckpoints(int nHeight, unsigned int nStakeModifierChecksum);
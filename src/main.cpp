@@ -13,6 +13,7 @@
 #include "accumulatormap.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockfilemap.h"
 #include "blocksignature.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -36,17 +37,20 @@
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 #include "zdeqchain.h"
+#include "zdeqspendcache.h"
 
 #include "primitives/zerocoin.h"
 #include "libzerocoin/Denominations.h"
 #include "invalid.h"
 
+#include <list>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -182,6 +186,20 @@ namespace
 	/** Number of preferable block download peers. */
 	int nPreferredDownload = 0;
 
+	/**
+	* Blocks that arrived from parallel download before their parent, keyed by the parent's hash, with the
+	* peer they came from. Proof of stake checks need the parent connected, so they wait here until the
+	* parent is accepted. Protected by cs_main.
+	*/
+	struct COutOfOrderBlock {
+		NodeId nodeid;
+		boost::shared_ptr<CBlock> pblock;
+		size_t nSize;
+	};
+	multimap<uint256, COutOfOrderBlock> mapOutOfOrderBlocks;
+	set<uint256> setOutOfOrderBlocks;
+	size_t nOutOfOrderBlocksSize = 0;
+
 	/** Dirty block index entries. */
 	set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -514,6 +532,9 @@ namespace
 		// linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
 		// download that next block if the window were 1 larger.
 		int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+		// While too many blocks wait for their parents, only fetch what lets the tip move.
+		if (nOutOfOrderBlocksSize > MAX_OUT_OF_ORDER_BLOCKS_SIZE)
+			nWindowEnd = std::min(nWindowEnd, chainActive.Height() + MAX_BLOCKS_IN_TRANSIT_PER_PEER);
 		int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
 		NodeId waitingfor = -1;
 		while (pindexWalk->nHeight < nMaxHeight) {
@@ -540,6 +561,9 @@ namespace
 					if (pindex->nChainTx)
 						state->pindexLastCommonBlock = pindex;
 				}
+				else if (setOutOfOrderBlocks.count(pindex->GetBlockHash())) {
+					// Downloaded already, waiting for its parent.
+				}
 				else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
 					// The block is not already downloaded, and not yet in flight.
 					if (pindex->nHeight > nWindowEnd) {
@@ -585,6 +609,7 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
 	nodeSignals.GetHeight.connect(&GetHeight);
 	nodeSignals.ProcessMessages.connect(&ProcessMessages);
+	nodeSignals.ProcessWorkerMessages.connect(&ProcessWorkerMessages);
 	nodeSignals.SendMessages.connect(&SendMessages);
 	nodeSignals.InitializeNode.connect(&InitializeNode);
 	nodeSignals.FinalizeNode.connect(&FinalizeNode);
@@ -594,6 +619,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
 	nodeSignals.GetHeight.disconnect(&GetHeight);
 	nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
+	nodeSignals.ProcessWorkerMessages.disconnect(&ProcessWorkerMessages);
 	nodeSignals.SendMessages.disconnect(&SendMessages);
 	nodeSignals.InitializeNode.disconnect(&InitializeNode);
 	nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
@@ -1076,7 +1102,49 @@ bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const Coi
 	return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state)
+bool CZerocoinSpendCheck::operator()()
+{
+	uint256 hashCache = GetZerocoinSpendCacheKey(*pspend, params, bnAccumulatorValue);
+	if (IsZerocoinSpendVerified(hashCache))
+		return true;
+
+	Accumulator accumulator(params, pspend->getDenomination(), bnAccumulatorValue);
+	if (!pspend->Verify(accumulator))
+		return ::error("CZerocoinSpendCheck(): zerocoin spend with serial %s in tx %s did not verify",
+			pspend->getCoinSerialNumber().GetHex(), txid.GetHex());
+
+	if (cacheStore)
+		SetZerocoinSpendVerified(hashCache);
+	return true;
+}
+
+static CCheckQueue<CZerocoinSpendCheck> zerocoinspendcheckqueue(16);
+/** Serializes masters of zerocoinspendcheckqueue: blocks and mempool transactions may be checked concurrently */
+static CCriticalSection cs_zerocoinspendcheckqueue;
+
+void ThreadZerocoinSpendCheck()
+{
+	RenameThread("dequant-zcspendch");
+	zerocoinspendcheckqueue.Thread();
+}
+
+bool RunZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks)
+{
+	if (!nScriptCheckThreads || vChecks.size() < 2) {
+		for (CZerocoinSpendCheck& check : vChecks) {
+			if (!check())
+				return false;
+		}
+		return true;
+	}
+
+	LOCK(cs_zerocoinspendcheckqueue);
+	CCheckQueueControl<CZerocoinSpendCheck> control(&zerocoinspendcheckqueue);
+	control.Add(vChecks);
+	return control.Wait();
+}
+
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks)
 {
 	//max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
 	if (tx.vout.size() > 2) {
@@ -1100,6 +1168,7 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
 	bool fValidated = false;
 	set<CBigNum> serials;
 	list<CoinSpend> vSpends;
+	std::vector<CZerocoinSpendCheck> vChecks;
 	CAmount nTotalRedeemed = 0;
 	for (const CTxIn& txin : tx.vin) {
 
@@ -1131,12 +1200,9 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
 				return state.DoS(100, error("%s: Zerocoinspend could not find accumulator associated with checksum %s", __func__, HexStr(BEGIN(nChecksum), END(nChecksum))));
 			}
 
-			Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
-				newSpend.getDenomination(), bnAccumulatorValue);
-
-			//Check that the coin has been accumulated
-			if (!newSpend.Verify(accumulator))
-				return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+			//Check that the coin has been accumulated, possibly in parallel with the other spends
+			vChecks.emplace_back(newSpend, Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
+				bnAccumulatorValue, tx.GetHash(), pvChecks == NULL);
 		}
 
 		if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1153,10 +1219,20 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
 		return state.DoS(100, error("Transaction spend more than was redeemed in zerocoins"));
 	}
 
+	if (pvChecks) {
+		pvChecks->reserve(pvChecks->size() + vChecks.size());
+		for (CZerocoinSpendCheck& check : vChecks) {
+			pvChecks->push_back(CZerocoinSpendCheck());
+			check.swap(pvChecks->back());
+		}
+	} else if (!RunZerocoinSpendChecks(vChecks)) {
+		return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+	}
+
 	return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks)
 {
 	// Basic checks that don't depend on any context
 	if (tx.vin.empty())
@@ -1212,7 +1288,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
 
 			// Do not require signature verification if this is initial sync and a block over 24 hours old
 			bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60 * 60 * 24));
-			if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+			if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
 				return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
 		}
 	}
@@ -1307,6 +1383,31 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 	return nMinFee;
 }
 
+bool IsMempoolEvictionExempt(const CTransaction& tx)
+{
+	// The zdeq tracker forgets pending spends that are missing from the pool
+	if (tx.IsZerocoinSpend())
+		return true;
+
+	// SwiftX locked transactions have to be mined as they are
+	BOOST_FOREACH(const CTxIn& in, tx.vin) {
+		std::map<COutPoint, uint256>::const_iterator it = mapLockedInputs.find(in.prevout);
+		if (it != mapLockedInputs.end() && it->second == tx.GetHash())
+			return true;
+	}
+	return false;
+}
+
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+	std::list<CTransaction> removed;
+	int expired = pool.Expire(GetTime() - age, removed);
+	if (expired != 0)
+		LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+	pool.TrimToSize(limit, removed);
+}
+
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
 {
@@ -1527,6 +1628,30 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 				hash.ToString(),
 				nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+		// Once the pool has been trimmed to -maxmempool, a transaction has to pay
+		// more than the packages that were evicted until the pool drains again
+		if (!ignoreFees && !IsMempoolEvictionExempt(tx)) {
+			double dModPriority = 0;
+			CAmount nModFees = nFees;
+			pool.ApplyDeltas(hash, dModPriority, nModFees);
+			CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+			if (mempoolRejectFee > 0 && nModFees < mempoolRejectFee)
+				return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+					hash.ToString(), nModFees, mempoolRejectFee),
+					REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+		}
+
+		// Calculate in-mempool ancestors, up to a limit.
+		CTxMemPool::setEntries setAncestors;
+		size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+		size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+		size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+		size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+		std::string errString;
+		if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+			return state.DoS(0, error("AcceptToMemoryPool : too long mempool chain %s: %s", hash.ToString(), errString),
+				REJECT_NONSTANDARD, "too-long-mempool-chain");
+
 		// Check against previous transactions
 		// This is done last to help prevent CPU exhaustion denial-of-service attacks.
 		if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1547,7 +1672,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 		}
 
 		// Store transaction in memory
-		pool.addUnchecked(hash, entry);
+		pool.addUnchecked(hash, entry, setAncestors);
+
+		// Trim the pool and check that the transaction made it
+		LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+		if (!pool.exists(hash))
+			return state.DoS(0, error("AcceptToMemoryPool : mempool full, %s not accepted", hash.ToString()),
+				REJECT_INSUFFICIENTFEE, "mempool full");
 	}
 
 	SyncWithWallets(tx, NULL);
@@ -1852,21 +1983,64 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
 	return true;
 }
 
+/** Whether nFile has been finalized, i.e. blocks are no longer appended to it */
+static bool IsBlockFileFinal(int nFile)
+{
+	LOCK(cs_LastBlockFile);
+	return nFile < nLastBlockFile;
+}
+
+/**
+ * Locate the block stored at pos in a mapped block file. The block is preceded
+ * on disk by the network magic and its size, which bound the span returned.
+ * Returns NULL if the file is not mapped or the record doesn't check out, in
+ * which case the caller should fall back to reading the file.
+ */
+static const char* GetMappedBlockRecord(boost::shared_ptr<const CMappedBlockFile>& pfile, const CDiskBlockPos& pos, unsigned int& nSize)
+{
+	if (pos.nPos < MESSAGE_START_SIZE + sizeof(nSize) || !IsBlockFileFinal(pos.nFile))
+		return NULL;
+	pfile = GetMappedBlockFile(pos.nFile, GetBlockPosFilename(pos, "blk"));
+	if (!pfile)
+		return NULL;
+
+	const char* pheader = pfile->GetRange(pos.nPos - MESSAGE_START_SIZE - sizeof(nSize), MESSAGE_START_SIZE + sizeof(nSize));
+	if (!pheader || memcmp(pheader, Params().MessageStart(), MESSAGE_START_SIZE))
+		return NULL;
+	CSpanReader(pheader + MESSAGE_START_SIZE, pheader + MESSAGE_START_SIZE + sizeof(nSize), SER_DISK, CLIENT_VERSION) >> nSize;
+	if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+		return NULL;
+	return pfile->GetRange(pos.nPos, nSize);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
 	block.SetNull();
 
-	// Open history file to read
-	CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-	if (filein.IsNull())
-		return error("ReadBlockFromDisk : OpenBlockFile failed");
+	boost::shared_ptr<const CMappedBlockFile> pfile;
+	unsigned int nSize = 0;
+	const char* pblock = GetMappedBlockRecord(pfile, pos, nSize);
 
 	// Read block
-	try {
-		filein >> block;
-	}
-	catch (std::exception& e) {
-		return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+	if (pblock) {
+		try {
+			CSpanReader(pblock, pblock + nSize, SER_DISK, CLIENT_VERSION) >> block;
+		}
+		catch (std::exception& e) {
+			return error("%s : Deserialize error in mapped block file - %s", __func__, e.what());
+		}
+	} else {
+		// Open history file to read
+		CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+		if (filein.IsNull())
+			return error("ReadBlockFromDisk : OpenBlockFile failed");
+
+		try {
+			filein >> block;
+		}
+		catch (std::exception& e) {
+			return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+		}
 	}
 
 	// Check the header
@@ -1878,6 +2052,43 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 	return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos)
+{
+	vchBlock.clear();
+
+	boost::shared_ptr<const CMappedBlockFile> pfile;
+	unsigned int nSize = 0;
+	const char* pblock = GetMappedBlockRecord(pfile, pos, nSize);
+	if (pblock) {
+		vchBlock.assign(pblock, pblock + nSize);
+		return true;
+	}
+
+	if (pos.nPos < MESSAGE_START_SIZE + sizeof(nSize))
+		return error("%s : no block record at %d:%u", __func__, pos.nFile, pos.nPos);
+	CDiskBlockPos posRecord(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(nSize));
+	CAutoFile filein(OpenBlockFile(posRecord, true), SER_DISK, CLIENT_VERSION);
+	if (filein.IsNull())
+		return error("%s : OpenBlockFile failed", __func__);
+
+	try {
+		unsigned char buf[MESSAGE_START_SIZE];
+		filein >> FLATDATA(buf);
+		if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+			return error("%s : block magic mismatch at %d:%u", __func__, pos.nFile, pos.nPos);
+		filein >> nSize;
+		if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+			return error("%s : invalid block size %u at %d:%u", __func__, nSize, pos.nFile, pos.nPos);
+		vchBlock.resize(nSize);
+		filein.read((char*)&vchBlock[0], nSize);
+	}
+	catch (std::exception& e) {
+		return error("%s : I/O error - %s", __func__, e.what());
+	}
+
+	return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
 	if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
@@ -2516,10 +2727,9 @@ void RecalculateZDEQMinted()
 		std::list<CZerocoinMint> listMints;
 		BlockToZerocoinMintList(block, listMints, true);
 
-		vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-		pindex->vMintDenominationsInBlock.clear();
+		pindex->mintDenominations.SetNull();
 		for (auto mint : listMints)
-			pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+			pindex->mintDenominations.Add(mint.GetDenomination());
 
 		if (pindex->nHeight < nHeightEnd)
 			pindex = chainActive.Next(pindex);
@@ -2542,17 +2752,15 @@ void RecalculateZDEQSpent()
 		list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
 
 		//Reset the supply to previous block
-		pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
+		pindex->zerocoinSupply = pindex->pprev->zerocoinSupply;
 
 		//Add mints to zdeq supply
-		for (auto denom : libzerocoin::zerocoinDenomList) {
-			long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-			pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
-		}
+		for (auto denom : libzerocoin::zerocoinDenomList)
+			pindex->zerocoinSupply.at(denom) += pindex->mintDenominations.Count(denom);
 
 		//Remove spends from zdeq supply
 		for (auto denom : listDenomsSpent)
-			pindex->mapZerocoinSupply.at(denom)--;
+			pindex->zerocoinSupply.at(denom)--;
 
 		//Rewrite money supply
 		assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
@@ -2694,19 +2902,19 @@ bool UpdateZDEQSupply(const CBlock& block, CBlockIndex* pindex)
 	// Initialize zerocoin supply to the supply from previous block
 	if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3) {
 		for (auto& denom : zerocoinDenomList) {
-			pindex->mapZerocoinSupply.at(denom) = pindex->pprev->mapZerocoinSupply.at(denom);
+			pindex->zerocoinSupply.at(denom) = pindex->pprev->zerocoinSupply.at(denom);
 		}
 	}
 
 	// Track zerocoin money supply
 	CAmount nAmountZerocoinSpent = 0;
-	pindex->vMintDenominationsInBlock.clear();
+	pindex->mintDenominations.SetNull();
 	if (pindex->pprev) {
 		std::set<uint256> setAddedToWallet;
 		for (auto& m : listMints) {
 			libzerocoin::CoinDenomination denom = m.GetDenomination();
-			pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
-			pindex->mapZerocoinSupply.at(denom)++;
+			pindex->mintDenominations.Add(denom);
+			pindex->zerocoinSupply.at(denom)++;
 
 			//Remove any of our own mints from the mintpool
 			if (pwalletMain) {
@@ -2731,17 +2939,17 @@ bool UpdateZDEQSupply(const CBlock& block, CBlockIndex* pindex)
 		}
 
 		for (auto& denom : listSpends) {
-			pindex->mapZerocoinSupply.at(denom)--;
+			pindex->zerocoinSupply.at(denom)--;
 			nAmountZerocoinSpent += libzerocoin::ZerocoinDenominationToAmount(denom);
 
 			// zerocoin failsafe
-			if (pindex->mapZerocoinSupply.at(denom) < 0)
+			if (pindex->zerocoinSupply.at(denom) < 0)
 				return error("Block contains zerocoins that spend more than are in the available supply to spend");
 		}
 	}
 
 	for (auto& denom : zerocoinDenomList)
-		LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->mapZerocoinSupply.at(denom));
+		LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->zerocoinSupply.at(denom));
 
 	return true;
 }
@@ -3219,6 +3427,7 @@ bool static DisconnectTip(CValidationState& state)
 	mempool.check(pcoinsTip);
 	// Update chainActive and related variables.
 	UpdateTip(pindexDelete->pprev);
+	InvalidateStakeModifierCache(pindexDelete->nHeight);
 	// Let wallets know transactions went from 1-confirmed to
 	// 0-confirmed or conflicted:
 	BOOST_FOREACH(const CTransaction& tx, block.vtx) {
@@ -3696,6 +3905,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
 	// to avoid miners withholding blocks but broadcasting headers, to get a
 	// competitive advantage.
 	pindexNew->nSequenceId = 0;
+	pindexNew->nStatus |= BLOCK_HASH_VERIFIED;
 	BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
 	//mark as PoS seen
@@ -3709,21 +3919,27 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
 		pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
 		pindexNew->BuildSkip();
 
+		// A header alone doesn't show the coinstake, but every block after the last PoW block is
+		// proof of stake. Trust and stake modifiers only need the flag; the stake itself is
+		// recorded by ReceivedBlockTransactions once the block arrives.
+		if (block.vtx.empty() && pindexNew->nHeight > Params().LAST_POW_BLOCK())
+			pindexNew->SetProofOfStake();
+
 		//update previous block pointer
 		pindexNew->pprev->pnext = pindexNew;
 
-		// ppcoin: compute chain trust score
-		pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
-
 		// ppcoin: compute stake entropy bit for stake modifier
 		if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
 			LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
 
-		// ppcoin: record proof-of-stake hash value
-		if (pindexNew->IsProofOfStake()) {
-			if (!mapProofOfStake.count(hash))
+		// ppcoin: look up proof-of-stake hash value
+		uint256 hashProofOfStake;
+		if (pindexNew->IsProofOfStake() && !block.vtx.empty()) {
+			map<uint256, uint256>::const_iterator itProof = mapProofOfStake.find(hash);
+			if (itProof == mapProofOfStake.end())
 				LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-			pindexNew->hashProofOfStake = mapProofOfStake[hash];
+			else
+				hashProofOfStake = itProof->second;
 		}
 
 		// ppcoin: compute stake modifier
@@ -3732,7 +3948,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
 		if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
 			LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
 		pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-		pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
+		pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew, hashProofOfStake);
 		if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
 			LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, boost::lexical_cast<std::string>(nStakeModifier));
 	}
@@ -3753,8 +3969,15 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBlockIndex* pindexNew, const CDiskBlockPos& pos)
 {
-	if (block.IsProofOfStake())
+	if (block.IsProofOfStake()) {
 		pindexNew->SetProofOfStake();
+		if (pindexNew->prevoutStake.IsNull()) {
+			// The index was made from the header; record the stake now that we have it
+			pindexNew->prevoutStake = block.vtx[1].vin[0].prevout;
+			pindexNew->nStakeTime = block.nTime;
+			setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+		}
+	}
 	pindexNew->nTx = block.vtx.size();
 	pindexNew->nChainTx = 0;
 	pindexNew->nFile = pos.nFile;
@@ -3911,7 +4134,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 			REJECT_INVALID, "bad-header", true);
 
 	// Check timestamp
-	LogPrint("debug", "%s: block=%s  is proof of stake=%d\n", __func__, block.GetHash().ToString().c_str(), block.IsProofOfStake());
+	if (LogAcceptCategory("debug"))
+		LogPrint("debug", "%s: block=%s  is proof of stake=%d\n", __func__, block.GetHash().ToString().c_str(), block.IsProofOfStake());
 	if (block.GetBlockTime() > GetAdjustedTime() + (block.IsProofOfStake() ? 180 : 7200)) // 3 minute future drift for PoS
 		return state.Invalid(error("CheckBlock() : block timestamp too far in the future"),
 			REJECT_INVALID, "time-too-new");
@@ -4021,8 +4245,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 	// Check transactions
 	bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
 	vector<CBigNum> vBlockSerials;
+	// The zerocoin spend proofs of the whole block are verified together once the cheap checks have passed
+	std::vector<CZerocoinSpendCheck> vZerocoinChecks;
 	for (const CTransaction& tx : block.vtx) {
-		if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state))
+		if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state, &vZerocoinChecks))
 			return error("CheckBlock() : CheckTransaction failed");
 
 		// double check that there are no double spent zdeq spends in this block
@@ -4049,6 +4275,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 		return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
 			REJECT_INVALID, "bad-blk-sigops", true);
 
+	if (!RunZerocoinSpendChecks(vZerocoinChecks))
+		return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"),
+			REJECT_INVALID, "bad-zerocoinspend");
+
 	return true;
 }
 
@@ -4174,6 +4404,29 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 	return true;
 }
 
+/**
+ * Checks for a header received without its block. Proof of work can be checked right away, and the
+ * difficulty of every block follows from the headers before it. The kernel of a proof of stake block
+ * is in its coinstake, so that is checked by AcceptBlock when the block arrives.
+ */
+static bool CheckHeaderProof(const CBlock& block, CValidationState& state, CBlockIndex* const pindexPrev)
+{
+	const int nHeight = pindexPrev->nHeight + 1;
+	if (nHeight <= Params().LAST_POW_BLOCK()) {
+		if (!CheckProofOfWork(block.GetHash(), block.nBits))
+			return state.DoS(50, error("%s : proof of work failed", __func__), REJECT_INVALID, "high-hash");
+		if (!CheckWork(block, pindexPrev))
+			return state.DoS(100, error("%s : incorrect difficulty at %d", __func__, nHeight), REJECT_INVALID, "bad-diffbits");
+	}
+	else {
+		if (block.nBits != GetNextWorkRequired(pindexPrev, &block))
+			return state.DoS(100, error("%s : incorrect difficulty at %d", __func__, nHeight), REJECT_INVALID, "bad-diffbits");
+		if (block.GetBlockTime() > GetAdjustedTime() + 180) // 3 minute future drift for PoS, as in CheckBlock
+			return state.Invalid(error("%s : block timestamp too far in the future", __func__), REJECT_INVALID, "time-too-new");
+	}
+	return true;
+}
+
 bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex)
 {
 	AssertLockHeld(cs_main);
@@ -4226,6 +4479,9 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
 	if (!ContextualCheckBlockHeader(block, state, pindexPrev))
 		return false;
 
+	if (block.vtx.empty() && pindexPrev && !CheckHeaderProof(block, state, pindexPrev))
+		return false;
+
 	if (pindex == NULL)
 		pindex = AddToBlockIndex(block);
 
@@ -4683,6 +4939,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
 		return error("%s : ActivateBestChain failed", __func__);
 
 	if (!fLiteMode) {
+		mnodeman.CheckCollaterals();
 		if (masternodeSync.RequestedMasternodeAssets > MASTERNODE_SYNC_LIST) {
 			obfuScationPool.NewBlock();
 			masternodePayments.ProcessBlock(GetHeight() + 10);
@@ -4818,8 +5075,11 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB(string& strError)
 {
+	int64_t nTimeStart = GetTimeMicros();
 	if (!pblocktree->LoadBlockIndexGuts())
 		return false;
+	int64_t nTimeGuts = GetTimeMicros();
+	LogPrint("bench", "  - Load block index entries: %.2fms\n", 0.001 * (nTimeGuts - nTimeStart));
 
 	boost::this_thread::interruption_point();
 
@@ -4857,6 +5117,7 @@ bool static LoadBlockIndexDB(string& strError)
 		if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
 			pindexBestHeader = pindex;
 	}
+	LogPrint("bench", "  - Calculate chain work for %u entries: %.2fms\n", vSortedByHeight.size(), 0.001 * (GetTimeMicros() - nTimeGuts));
 
 	// Load block file info
 	pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -5021,6 +5282,15 @@ void UnloadBlockIndex()
 	pindexBestInvalid = NULL;
 }
 
+size_t GetBlockIndexUsage()
+{
+	// Every entry is its own allocation, and so is the map node holding its hash and pointer.
+	// Allocations are rounded up to 16 bytes with 8 bytes of overhead, as glibc does.
+	AssertLockHeld(cs_main);
+	size_t nEntry = ((sizeof(CBlockIndex) + 8 + 15) & ~15) + ((sizeof(BlockMap::value_type) + 2 * sizeof(void*) + 8 + 15) & ~15);
+	return mapBlockIndex.size() * nEntry + mapBlockIndex.bucket_count() * sizeof(void*);
+}
+
 bool LoadBlockIndex(string& strError)
 {
 	// Load block index from databases
@@ -5444,6 +5714,141 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+/** Whether we sync with this peer by headers; older peers answer "getheaders" with an inv, like "getblocks" */
+static bool IsHeadersPeer(const CNode* pnode)
+{
+	return Params().HeadersFirstSyncingActive() && pnode->nVersion >= HEADERS_FIRST_VERSION;
+}
+
+/**
+ * Keep a block we requested whose parent we only have the header of, until the parent is accepted.
+ * Returns false if the parent's data is there, so the block can be processed now.
+ */
+static bool StoreOutOfOrderBlock(CNode* pfrom, const CBlock& block)
+{
+	LOCK(cs_main);
+	BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+	if (mi == mapBlockIndex.end() || (mi->second->nStatus & BLOCK_HAVE_DATA))
+		return false;
+
+	const uint256 hash = block.GetHash();
+	map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+	if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId()) {
+		LogPrint("net", "%s : ignoring unrequested block %s ahead of its parent, peer=%d\n", __func__, hash.ToString(), pfrom->id);
+		return true;
+	}
+	MarkBlockAsReceived(hash);
+	if (!setOutOfOrderBlocks.insert(hash).second)
+		return true;
+
+	COutOfOrderBlock entry = { pfrom->GetId(), boost::shared_ptr<CBlock>(new CBlock(block)), ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) };
+	mapOutOfOrderBlocks.insert(make_pair(block.hashPrevBlock, entry));
+	nOutOfOrderBlocksSize += entry.nSize;
+	LogPrint("net", "%s : block %s waits for its parent, peer=%d (%u bytes waiting)\n", __func__, hash.ToString(), pfrom->id, nOutOfOrderBlocksSize);
+	return true;
+}
+
+/** Process the blocks that were waiting for hashParent, then the ones waiting for those */
+static void ProcessOutOfOrderBlocks(const uint256& hashParent)
+{
+	// Blocks to look for children of, and whether those descend from an invalid block
+	std::deque<std::pair<uint256, bool> > queue(1, std::make_pair(hashParent, false));
+	while (!queue.empty()) {
+		const uint256 hash = queue.front().first;
+		const bool fInvalidParent = queue.front().second;
+		queue.pop_front();
+
+		std::vector<COutOfOrderBlock> vChildren;
+		{
+			LOCK(cs_main);
+			std::pair<multimap<uint256, COutOfOrderBlock>::iterator, multimap<uint256, COutOfOrderBlock>::iterator> range = mapOutOfOrderBlocks.equal_range(hash);
+			if (range.first == range.second)
+				continue;
+			BlockMap::iterator mi = mapBlockIndex.find(hash);
+			const bool fFailed = fInvalidParent || (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_FAILED_MASK));
+			// Unless the parent is invalid, its children wait until it is accepted
+			if (!fFailed && (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)))
+				continue;
+			for (multimap<uint256, COutOfOrderBlock>::iterator it = range.first; it != range.second; ++it) {
+				const uint256 hashChild = it->second.pblock->GetHash();
+				setOutOfOrderBlocks.erase(hashChild);
+				nOutOfOrderBlocksSize -= it->second.nSize;
+				if (fFailed) {
+					queue.push_back(std::make_pair(hashChild, true));
+					continue;
+				}
+				mapBlockSource[hashChild] = it->second.nodeid;
+				vChildren.push_back(it->second);
+			}
+			mapOutOfOrderBlocks.erase(range.first, range.second);
+		}
+
+		BOOST_FOREACH (const COutOfOrderBlock& child, vChildren) {
+			CValidationState state;
+			ProcessNewBlock(state, NULL, child.pblock.get());
+			int nDoS;
+			if (state.IsInvalid(nDoS) && nDoS > 0) {
+				LOCK(cs_main);
+				Misbehaving(child.nodeid, nDoS);
+			}
+			queue.push_back(std::make_pair(child.pblock->GetHash(), false));
+		}
+	}
+}
+
+namespace
+{
+/** A block as stored on disk, ready to be sent as the payload of a block message */
+struct CRawBlock {
+	std::vector<unsigned char> vchBlock;
+	unsigned int nChecksum;
+};
+
+/** Number of recently requested blocks kept serialized for serving to peers */
+static const unsigned int MAX_RAW_BLOCK_CACHE = 16;
+
+/** Recently served blocks, most recently requested first. Protected by cs_main. */
+std::list<std::pair<uint256, boost::shared_ptr<const CRawBlock> > > listRawBlockCache;
+} // anon namespace
+
+/** The serialized block at pindex, from the cache or disk. NULL if it can't be read. */
+static boost::shared_ptr<const CRawBlock> GetRawBlock(const CBlockIndex* pindex)
+{
+	AssertLockHeld(cs_main);
+	const uint256 hash = pindex->GetBlockHash();
+	for (std::list<std::pair<uint256, boost::shared_ptr<const CRawBlock> > >::iterator it = listRawBlockCache.begin(); it != listRawBlockCache.end(); ++it) {
+		if (it->first == hash) {
+			listRawBlockCache.splice(listRawBlockCache.begin(), listRawBlockCache, it);
+			return it->second;
+		}
+	}
+
+	boost::shared_ptr<CRawBlock> pblock(new CRawBlock());
+	if (!ReadRawBlockFromDisk(pblock->vchBlock, pindex->GetBlockPos()))
+		return boost::shared_ptr<const CRawBlock>();
+
+	// Only the header is checked against the index; the rest is what WriteBlockToDisk stored
+	CBlockHeader header;
+	try {
+		const char* pbegin = (const char*)&pblock->vchBlock[0];
+		CSpanReader(pbegin, pbegin + pblock->vchBlock.size(), SER_DISK, CLIENT_VERSION) >> header;
+	}
+	catch (std::exception& e) {
+		error("%s : Deserialize error - %s", __func__, e.what());
+		return boost::shared_ptr<const CRawBlock>();
+	}
+	if (header.GetHash() != hash) {
+		error("%s : block at %d:%u doesn't match index %s", __func__, pindex->nFile, pindex->nDataPos, hash.ToString());
+		return boost::shared_ptr<const CRawBlock>();
+	}
+	pblock->nChecksum = GetMessageChecksum(pblock->vchBlock.begin(), pblock->vchBlock.end());
+
+	listRawBlockCache.push_front(std::make_pair(hash, pblock));
+	if (listRawBlockCache.size() > MAX_RAW_BLOCK_CACHE)
+		listRawBlockCache.pop_back();
+	return pblock;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
 	std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -5483,13 +5888,17 @@ void static ProcessGetData(CNode* pfrom)
 				// Don't send not-validated blocks
 				if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
 					// Send block from disk
-					CBlock block;
-					if (!ReadBlockFromDisk(block, (*mi).second))
-						assert(!"cannot load block from disk");
-					if (inv.type == MSG_BLOCK)
-						pfrom->PushMessage("block", block);
-					else // MSG_FILTERED_BLOCK)
+					if (inv.type == MSG_BLOCK) {
+						// Pass on the block as stored, instead of deserializing and serializing it again
+						boost::shared_ptr<const CRawBlock> pblock = GetRawBlock((*mi).second);
+						if (!pblock)
+							assert(!"cannot load block from disk");
+						pfrom->PushRawMessage("block", pblock->vchBlock, pblock->nChecksum);
+					} else // MSG_FILTERED_BLOCK)
 					{
+						CBlock block;
+						if (!ReadBlockFromDisk(block, (*mi).second))
+							assert(!"cannot load block from disk");
 						LOCK(pfrom->cs_filter);
 						if (pfrom->pfilter) {
 							CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5921,9 +6330,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 			if (inv.type == MSG_BLOCK) {
 				UpdateBlockAvailability(pfrom->GetId(), inv.hash);
 				if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-					// Add this to the list of blocks to request
-					vToFetch.push_back(inv);
-					LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+					if (IsHeadersPeer(pfrom)) {
+						// First ask for the headers leading to the announced block, so they are validated by the
+						// time it arrives. When we are close to synced, also ask for the block itself to save a
+						// round trip; otherwise the download window fetches it.
+						pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+						CNodeState* nodestate = State(pfrom->GetId());
+						if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
+							nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+							vToFetch.push_back(inv);
+							// The getdata goes out below, under the same cs_main lock.
+							MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+						}
+						LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+					}
+					else {
+						// Add this to the list of blocks to request
+						vToFetch.push_back(inv);
+						LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+					}
 				}
 			}
 
@@ -5961,7 +6386,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 	}
 
 
-	else if (strCommand == "getblocks" || strCommand == "getheaders") {
+	else if (strCommand == "getblocks" || (strCommand == "getheaders" && !IsHeadersPeer(pfrom))) {
 		CBlockLocator locator;
 		uint256 hashStop;
 		vRecv >> locator >> hashStop;
@@ -5993,14 +6418,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 	}
 
 
-	else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+	else if (strCommand == "getheaders") {
 		CBlockLocator locator;
 		uint256 hashStop;
 		vRecv >> locator >> hashStop;
 
 		LOCK(cs_main);
 
-		if (IsInitialBlockDownload())
+		if (IsInitialBlockDownload() && !pfrom->fWhitelisted)
 			return true;
 
 		CBlockIndex* pindex = NULL;
@@ -6021,8 +6446,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 		// we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
 		vector<CBlock> vHeaders;
 		int nLimit = MAX_HEADERS_RESULTS;
-		if (fDebug)
-			LogPrintf("getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
+		LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
 		for (; pindex; pindex = chainActive.Next(pindex)) {
 			vHeaders.push_back(pindex->GetBlockHeader());
 			if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
@@ -6226,10 +6650,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 				return error("non-continuous headers sequence");
 			}
 
-			/*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-			* before headers are reimplemented on mainnet
-			*/
-			if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+			// Without transactions, AcceptBlockHeader checks what the header alone can prove
+			if (!AcceptBlockHeader(CBlock(header), state, &pindexLast)) {
 				int nDoS;
 				if (state.IsInvalid(nDoS)) {
 					if (nDoS > 0)
@@ -6247,7 +6669,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 			// Headers message had its maximum size; the peer may have more headers.
 			// TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
 			// from there instead.
-			LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
+			LogPrint("net", "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
 			pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
 		}
 
@@ -6264,7 +6686,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
 		//sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
 		if (!mapBlockIndex.count(block.hashPrevBlock)) {
-			if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+			if (IsHeadersPeer(pfrom)) {
+				// Get the headers connecting it; the block itself is then fetched through the download window
+				LOCK(cs_main);
+				MarkBlockAsReceived(hashBlock);
+				pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+			}
+			else if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
 				//we already asked for this block, so lets work backwards and ask for the previous block
 				pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
 				pfrom->vBlockRequested.push_back(block.hashPrevBlock);
@@ -6275,11 +6703,21 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 				pfrom->vBlockRequested.push_back(hashBlock);
 			}
 		}
+		else if (StoreOutOfOrderBlock(pfrom, block)) {
+			pfrom->AddInventoryKnown(inv);
+		}
 		else {
 			pfrom->AddInventoryKnown(inv);
 
 			CValidationState state;
-			if (!mapBlockIndex.count(block.GetHash())) {
+			bool fHaveData = false;
+			{
+				LOCK(cs_main);
+				BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+				// With headers-first sync the index usually exists already, from the header
+				fHaveData = mi != mapBlockIndex.end() && (mi->second->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK));
+			}
+			if (!fHaveData) {
 				ProcessNewBlock(state, pfrom, &block);
 				int nDoS;
 				if (state.IsInvalid(nDoS)) {
@@ -6292,6 +6730,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 				}
 				//disconnect this node if its old protocol version
 				pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
+
+				ProcessOutOfOrderBlocks(hashBlock);
 			}
 			else {
 				LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
@@ -6306,7 +6746,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 	// Making users (which are behind NAT and can only make outgoing connections) ignore
 	// getaddr message mitigates the attack.
 	else if ((strCommand == "getaddr") && (pfrom->fInbound)) {
-		pfrom->vAddrToSend.clear();
+		{
+			LOCK(pfrom->cs_vAddrToSend);
+			pfrom->vAddrToSend.clear();
+		}
 		vector<CAddress> vAddr = addrman.GetAddr();
 		BOOST_FOREACH(const CAddress& addr, vAddr)
 			pfrom->PushAddress(addr);
@@ -6559,6 +7002,78 @@ int ActiveProtocol()
 	return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
 }
 
+/** Messages that don't need cs_main, processed by the message workers when there are any */
+static bool IsWorkerLaneCommand(const std::string& strCommand)
+{
+	return strCommand == "addr" || strCommand == "mnp" || strCommand == "mnw" ||
+		strCommand == "mvote" || strCommand == "txlvote";
+}
+
+// Check the header and checksum of a complete message and process it.
+// Returns false if the message was dropped without processing.
+static bool ProcessNetMessage(CNode* pfrom, CNetMessage& msg, bool fWorkerLane)
+{
+	// Read header
+	CMessageHeader& hdr = msg.hdr;
+	if (!hdr.IsValid()) {
+		LogPrintf("PROCESSMESSAGE: ERRORS IN HEADER %s peer=%d\n", SanitizeString(hdr.GetCommand()), pfrom->id);
+		return false;
+	}
+	string strCommand = hdr.GetCommand();
+
+	// Message size
+	unsigned int nMessageSize = hdr.nMessageSize;
+
+	// Checksum
+	// computed while the data was received
+	CDataStream& vRecv = msg.vRecv;
+	const uint256& hash = msg.GetMessageHash();
+	unsigned int nChecksum = 0;
+	memcpy(&nChecksum, &hash, sizeof(nChecksum));
+	if (nChecksum != hdr.nChecksum) {
+		LogPrintf("ProcessMessages(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
+			SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
+		return false;
+	}
+
+	// Process message
+	bool fRet = false;
+	int64_t nTimeStart = GetTimeMicros();
+	try {
+		fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+		boost::this_thread::interruption_point();
+	}
+	catch (std::ios_base::failure& e) {
+		pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
+		if (strstr(e.what(), "end of data")) {
+			// Allow exceptions from under-length message on vRecv
+			LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
+		}
+		else if (strstr(e.what(), "size too large")) {
+			// Allow exceptions from over-long size
+			LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
+		}
+		else {
+			PrintExceptionContinue(&e, "ProcessMessages()");
+		}
+	}
+	catch (boost::thread_interrupted) {
+		throw;
+	}
+	catch (std::exception& e) {
+		PrintExceptionContinue(&e, "ProcessMessages()");
+	}
+	catch (...) {
+		PrintExceptionContinue(NULL, "ProcessMessages()");
+	}
+	RecordMessageTime(strCommand, GetTimeMicros() - nTimeStart, fWorkerLane);
+
+	if (!fRet)
+		LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+
+	return true;
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -6574,6 +7089,7 @@ bool ProcessMessages(CNode* pfrom)
 	//  (x) data
 	//
 	bool fOk = true;
+	bool fWorkerMessages = false;
 
 	if (!pfrom->vRecvGetData.empty())
 		ProcessGetData(pfrom);
@@ -6609,71 +7125,64 @@ bool ProcessMessages(CNode* pfrom)
 			break;
 		}
 
-		// Read header
-		CMessageHeader& hdr = msg.hdr;
-		if (!hdr.IsValid()) {
-			LogPrintf("PROCESSMESSAGE: ERRORS IN HEADER %s peer=%d\n", SanitizeString(hdr.GetCommand()), pfrom->id);
-			continue;
-		}
-		string strCommand = hdr.GetCommand();
-
-		// Message size
-		unsigned int nMessageSize = hdr.nMessageSize;
-
-		// Checksum
-		CDataStream& vRecv = msg.vRecv;
-		uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-		unsigned int nChecksum = 0;
-		memcpy(&nChecksum, &hash, sizeof(nChecksum));
-		if (nChecksum != hdr.nChecksum) {
-			LogPrintf("ProcessMessages(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
-				SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
-			continue;
-		}
-
-		// Process message
-		bool fRet = false;
-		try {
-			fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
-			boost::this_thread::interruption_point();
-		}
-		catch (std::ios_base::failure& e) {
-			pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
-			if (strstr(e.what(), "end of data")) {
-				// Allow exceptions from under-length message on vRecv
-				LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
-			}
-			else if (strstr(e.what(), "size too large")) {
-				// Allow exceptions from over-long size
-				LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
-			}
-			else {
-				PrintExceptionContinue(&e, "ProcessMessages()");
+		// Hand messages that don't need cs_main to the worker lane, which keeps them in order
+		if (nMessageWorkers > 0 && pfrom->fSuccessfullyConnected && IsWorkerLaneCommand(msg.hdr.GetCommand())) {
+			LOCK(pfrom->cs_vRecvMsgWorker);
+			if (pfrom->nRecvMsgWorkerSize >= ReceiveFloodSize()) {
+				// keep it here, so receive flood control applies while the worker lane is backed up
+				--it;
+				break;
 			}
-		}
-		catch (boost::thread_interrupted) {
-			throw;
-		}
-		catch (std::exception& e) {
-			PrintExceptionContinue(&e, "ProcessMessages()");
-		}
-		catch (...) {
-			PrintExceptionContinue(NULL, "ProcessMessages()");
+			pfrom->nRecvMsgWorkerSize += msg.vRecv.size();
+			pfrom->vRecvMsgWorker.push_back(std::move(msg));
+			fWorkerMessages = true;
+			continue;
 		}
 
-		if (!fRet)
-			LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
-
-		break;
+		if (ProcessNetMessage(pfrom, msg, false))
+			break;
 	}
 
 	// In case the connection got shut down, its receive buffer was wiped
 	if (!pfrom->fDisconnect)
 		pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
 
+	if (fWorkerMessages)
+		WakeMessageWorkers();
+
 	return fOk;
 }
 
+// Process the next message on the worker lane of pfrom, unless another worker is already at it
+void ProcessWorkerMessages(CNode* pfrom)
+{
+	{
+		LOCK(pfrom->cs_vRecvMsgWorker);
+		if (pfrom->fRecvMsgWorkerBusy || pfrom->vRecvMsgWorker.empty())
+			return;
+		pfrom->fRecvMsgWorkerBusy = true;
+	}
+
+	// The message handler only appends to the deque, which leaves references to the front valid
+	CNetMessage& msg = pfrom->vRecvMsgWorker.front();
+	// processing consumes vRecv
+	size_t nSize = msg.vRecv.size();
+	try {
+		if (!pfrom->fDisconnect)
+			ProcessNetMessage(pfrom, msg, true);
+	}
+	catch (...) {
+		LOCK(pfrom->cs_vRecvMsgWorker);
+		pfrom->fRecvMsgWorkerBusy = false;
+		throw;
+	}
+
+	LOCK(pfrom->cs_vRecvMsgWorker);
+	pfrom->nRecvMsgWorkerSize -= nSize;
+	pfrom->vRecvMsgWorker.pop_front();
+	pfrom->fRecvMsgWorkerBusy = false;
+}
+
 
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
@@ -6722,8 +7231,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 			LOCK(cs_vNodes);
 			BOOST_FOREACH(CNode* pnode, vNodes) {
 				// Periodically clear setAddrKnown to allow refresh broadcasts
-				if (nLastRebroadcast)
+				if (nLastRebroadcast) {
+					LOCK(pnode->cs_vAddrToSend);
 					pnode->setAddrKnown.clear();
+				}
 
 				// Rebroadcast our address
 				AdvertizeLocal(pnode);
@@ -6736,20 +7247,27 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 		// Message: addr
 		//
 		if (fSendTrickle) {
+			vector<CAddress> vAddrNew;
+			{
+				// addr messages are processed on the worker lane, which pushes to vAddrToSend
+				LOCK(pto->cs_vAddrToSend);
+				vAddrNew.reserve(pto->vAddrToSend.size());
+				BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend) {
+					// returns true if wasn't already contained in the set
+					if (pto->setAddrKnown.insert(addr).second)
+						vAddrNew.push_back(addr);
+				}
+				pto->vAddrToSend.clear();
+			}
 			vector<CAddress> vAddr;
-			vAddr.reserve(pto->vAddrToSend.size());
-			BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend) {
-				// returns true if wasn't already contained in the set
-				if (pto->setAddrKnown.insert(addr).second) {
-					vAddr.push_back(addr);
-					// receiver rejects addr messages larger than 1000
-					if (vAddr.size() >= 1000) {
-						pto->PushMessage("addr", vAddr);
-						vAddr.clear();
-					}
+			BOOST_FOREACH(const CAddress& addr, vAddrNew) {
+				vAddr.push_back(addr);
+				// receiver rejects addr messages larger than 1000
+				if (vAddr.size() >= 1000) {
+					pto->PushMessage("addr", vAddr);
+					vAddr.clear();
 				}
 			}
-			pto->vAddrToSend.clear();
 			if (!vAddr.empty())
 				pto->PushMessage("addr", vAddr);
 		}
@@ -6782,10 +7300,15 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 			if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
 				state.fSyncStarted = true;
 				nSyncStarted++;
-				//CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-				//LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-				//pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-				pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+				if (IsHeadersPeer(pto)) {
+					// Blocks are then fetched in parallel from every peer that has them, see FindNextBlocksToDownload.
+					// Start one back from our best header so that the peer has something to answer with.
+					CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+					LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+					pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+				}
+				else
+					pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
 			}
 		}
 
@@ -35,6 +35,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -52,6 +53,7 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -78,6 +80,19 @@ static const unsigned int MAX_TX_SIGOPS_CURRENT = MAX_BLOCK_SIGOPS_CURRENT / 5;
 static const unsigned int MAX_TX_SIGOPS_LEGACY = MAX_BLOCK_SIGOPS_LEGACY / 5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors.
+ *  Leaves room for a maximum-size zerocoin transaction and a maximum-size standard one. */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = (MAX_ZEROCOIN_TX_SIZE + MAX_STANDARD_TX_SIZE) / 1000 + 1;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = (MAX_ZEROCOIN_TX_SIZE + MAX_STANDARD_TX_SIZE) / 1000 + 1;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 														  /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -104,6 +119,9 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
 *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Total size of downloaded blocks kept in memory until their parent is accepted. Past this, the
+*  download window shrinks to just ahead of the tip. */
+static const size_t MAX_OUT_OF_ORDER_BLOCKS_SIZE = 32 * 1000 * 1000;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -207,10 +225,14 @@ bool InitBlockIndex();
 bool LoadBlockIndex(std::string& strError);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Estimated bytes used by mapBlockIndex and the entries it owns. Requires cs_main. */
+size_t GetBlockIndexUsage();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
+/** Process the next message a given node has queued for the message workers */
+void ProcessWorkerMessages(CNode* pfrom);
 /**
 * Send queued protocol messages to be sent to a give node.
 *
@@ -220,6 +242,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend proof checking thread */
+void ThreadZerocoinSpendCheck();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -255,6 +279,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
+/** Whether a transaction has to stay in the memory pool until it is mined or conflicted */
+bool IsMempoolEvictionExempt(const CTransaction& tx);
+/** Expire old transactions from the pool and then trim it to limit bytes of memory */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
+
 int GetInputAge(CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
 bool GetCoinAge(const CTransaction& tx, unsigned int nTxTime, uint64_t& nCoinAge);
@@ -345,10 +374,16 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+/**
+* Context-independent validity checks. If pvZerocoinChecks is not NULL, zerocoin spend proof
+* verifications are pushed onto it instead of being performed inline. Spends verified inline
+* are remembered in the verified spend cache, so connecting them in a block later is cheap.
+*/
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks = NULL);
+/** Run a batch of zerocoin spend proof verifications, spread over the -par threads when available */
+bool RunZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend& spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend& spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
@@ -430,11 +465,44 @@ public:
 	ScriptError GetScriptError() const { return error; }
 };
 
+/**
+* Closure representing one zerocoin spend proof verification (accumulator proof,
+* commitment proof and serial number signature of knowledge).
+* All chain lookups are done by the caller, so this can run on any thread.
+*/
+class CZerocoinSpendCheck
+{
+private:
+	std::shared_ptr<const libzerocoin::CoinSpend> pspend;
+	const libzerocoin::ZerocoinParams* params;
+	CBigNum bnAccumulatorValue;
+	uint256 txid;
+	bool cacheStore;
+
+public:
+	CZerocoinSpendCheck() : params(NULL), bnAccumulatorValue(0), cacheStore(false) {}
+	CZerocoinSpendCheck(const libzerocoin::CoinSpend& spendIn, const libzerocoin::ZerocoinParams* paramsIn, const CBigNum& bnAccumulatorValueIn, const uint256& txidIn, bool cacheIn) :
+		pspend(std::make_shared<const libzerocoin::CoinSpend>(spendIn)), params(paramsIn), bnAccumulatorValue(bnAccumulatorValueIn), txid(txidIn), cacheStore(cacheIn) {}
+
+	bool operator()();
+
+	void swap(CZerocoinSpendCheck& check)
+	{
+		pspend.swap(check.pspend);
+		std::swap(params, check.params);
+		std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+		std::swap(txid, check.txid);
+		std::swap(cacheStore, check.cacheStore);
+	}
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized block stored at pos without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -465,7 +533,7 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL, bool fAlreadyCheckedBlock = false);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = NULL);
 
 
 class CBlockFileInfo
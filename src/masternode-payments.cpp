@@ -349,6 +349,7 @@ void CMasternodePayments::ProcessMessageMasternodePayments(CNode* pfrom, std::st
 
     if (fLiteMode) return; //disable all Obfuscation/Masternode related functionality
 
+    LOCK(cs_process_message);
 
     if (strCommand == "mnget") { //Masternode Payments Request Sync
         if (fLiteMode) return;   //disable all Obfuscation/Masternode related functionality
@@ -625,11 +626,52 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
         }
     }
 
-    mapMasternodeBlocks [winnerIn.nBlockHeight].AddPayee (winnerIn.GetPayeeScript (), winnerIn.GetPayeePhase (), 1);
+    {
+        LOCK(cs_mapMasternodeBlocks);
+
+        CScript payee = winnerIn.GetPayeeScript();
+        CMasternodeBlockPayees& blockPayees = mapMasternodeBlocks[winnerIn.nBlockHeight];
+        blockPayees.AddPayee(payee, winnerIn.GetPayeePhase(), 1);
+        if (blockPayees.HasPayeeWithVotes(payee, 2))
+            mapPaidHeights[payee].insert(winnerIn.nBlockHeight);
+    }
 
     return true;
 }
 
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nHeight, int nDepth)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPaidHeights.find(payee);
+    if (it == mapPaidHeights.end())
+        return 0;
+
+    // Votes for blocks after nHeight are not payments yet
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nHeight);
+    if (itHeight == it->second.begin())
+        return 0;
+    --itHeight;
+
+    if (*itHeight <= 0 || *itHeight <= nHeight - nDepth)
+        return 0;
+    return *itHeight;
+}
+
+void CMasternodePayments::RebuildLastPaidIndex()
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapPaidHeights.clear();
+    for (std::pair<const int, CMasternodeBlockPayees>& block : mapMasternodeBlocks) {
+        LOCK(cs_vecPayments);
+        for (const CMasternodePayee& payee : block.second.vecPayments) {
+            if (payee.nVotes >= 2)
+                mapPaidHeights[payee.scriptPubKey].insert(block.first);
+        }
+    }
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -783,6 +825,16 @@ void CMasternodePayments::CleanPaymentList()
             ++it;
         }
     }
+
+    std::map<CScript, std::set<int> >::iterator itPaid = mapPaidHeights.begin();
+    while (itPaid != mapPaidHeights.end()) {
+        std::set<int>& setHeights = itPaid->second;
+        setHeights.erase(setHeights.begin(), setHeights.lower_bound(nHeight - nLimit));
+        if (setHeights.empty())
+            mapPaidHeights.erase(itPaid++);
+        else
+            ++itPaid;
+    }
 }
 
 bool CMasternodePaymentWinner::IsValid(CNode* pnode, std::string& strError)
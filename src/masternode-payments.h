@@ -303,6 +303,11 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    //! Heights at which each payee has at least two votes in mapMasternodeBlocks, guarded by cs_mapMasternodeBlocks
+    std::map<CScript, std::set<int> > mapPaidHeights;
+    //! Taken first by ProcessMessageMasternodePayments, the message workers process mnw messages of different peers in parallel
+    CCriticalSection cs_process_message;
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -319,6 +324,7 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPaidHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -328,6 +334,13 @@ public:
     void CleanPaymentList();
     int LastPayment(CMasternode& mn);
 
+    /**
+     * Most recent height in the nDepth blocks ending at nHeight where the payee has at least two
+     * votes, or 0 if there is none. This is where CMasternode::GetLastPaid used to walk the chain.
+     */
+    int GetLastPaidHeight(const CScript& payee, int nHeight, int nDepth);
+    void RebuildLastPaidIndex();
+
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool GetBlockPayee (int nBlockHeight, unsigned mnlevel, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
@@ -383,6 +396,8 @@ public:
     {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildLastPaidIndex();
     }
 };
 
@@ -192,6 +192,8 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    /// Score against a block whose hash and hash-of-hash have already been computed
+    uint256 CalculateScore(const uint256& hashBlock, const uint256& hashBlockScore) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -219,6 +221,7 @@ public:
     }
 
     int64_t SecondsSincePayment();
+    int64_t SecondsSincePayment(int nDepth);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -249,7 +252,7 @@ public:
         lastPing = CMasternodePing();
     }
 
-    bool IsEnabled()
+    bool IsEnabled() const
     {
         return activeState == MASTERNODE_ENABLED;
     }
@@ -282,6 +285,7 @@ public:
     }
 
     int64_t GetLastPaid();
+    int64_t GetLastPaid(int nDepth);
     int64_t GetLastPaidBlock();
     bool IsValidNetAddr();
 };
@@ -36,8 +36,8 @@ struct CompareScoreTxIn {
 };
 
 struct CompareScoreMN {
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-        const pair<int64_t, CMasternode>& t2) const
+    bool operator()(const pair<int64_t, size_t>& t1,
+        const pair<int64_t, size_t>& t2) const
     {
         return t1.first < t2.first;
     }
@@ -197,6 +197,8 @@ void DumpMasternodes()
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
+    fIndexesDirty = false;
+    nSnapshotTime = 0;
 }
 
 bool CMasternodeMan::Add(CMasternode& mn)
@@ -210,6 +212,14 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        // appending keeps the indexed positions valid, so the new entry is indexed in place
+        bool fIndexesValid = !fIndexesDirty;
+        MasternodeListChanged();
+        if (fIndexesValid) {
+            mapIndexByOutPoint.insert(make_pair(mn.vin.prevout, vMasternodes.size() - 1));
+            mapIndexByPubKey.insert(make_pair(mn.pubKeyMasternode, vMasternodes.size() - 1));
+            fIndexesDirty = false;
+        }
         return true;
     }
 
@@ -280,6 +290,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            MasternodeListChanged();
         } else {
             ++it;
         }
@@ -341,6 +352,7 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    MasternodeListChanged();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -474,11 +486,11 @@ CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    if (fIndexesDirty) RebuildIndexes();
+
+    boost::unordered_map<COutPoint, size_t, CMasternodeOutPointHasher>::const_iterator it = mapIndexByOutPoint.find(vin.prevout);
+    if (it == mapIndexByOutPoint.end()) return NULL;
+    return &vMasternodes[it->second];
 }
 
 
@@ -486,11 +498,11 @@ CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
-    }
-    return NULL;
+    if (fIndexesDirty) RebuildIndexes();
+
+    boost::unordered_map<CPubKey, size_t, CMasternodePubKeyHasher>::const_iterator it = mapIndexByPubKey.find(pubKeyMasternode);
+    if (it == mapIndexByPubKey.end()) return NULL;
+    return &vMasternodes[it->second];
 }
 
 //
@@ -506,6 +518,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment (int nBlockHeigh
 
     CMasternode* pBestMasternode = NULL;
     std::vector<pair<int64_t, CTxIn> > vecMasternodeLastPaid;
+    std::map<unsigned int, int> mapLevelPaymentDepth;
 
     // Make a vector with all of the last paid times
     int nMnCount = CountEnabledOnLevel (masternodeLevel);
@@ -532,7 +545,13 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment (int nBlockHeigh
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        // Count the masternodes of each level once rather than once per masternode
+        unsigned int nLevel = mn.GetPhase();
+        std::map<unsigned int, int>::iterator itDepth = mapLevelPaymentDepth.find(nLevel);
+        if (itDepth == mapLevelPaymentDepth.end())
+            itDepth = mapLevelPaymentDepth.insert(make_pair(nLevel, (int)(CountEnabledOnLevel(nLevel) * 1.25))).first;
+
+        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(itDepth->second), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -631,15 +650,35 @@ CMasternode* CMasternodeMan::GetCurrentMasternodeOnLevel (unsigned int masternod
     return winner;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CMasternodeRankTable* CMasternodeMan::GetRankTable(int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
+    AssertLockHeld(cs);
+
+    //make sure we know about this block
+    uint256 hash = 0;
+    if (!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    // Masternode states are only rechecked every MASTERNODE_CHECK_SECONDS, rebuild at the same pace
+    int64_t nNow = GetTime();
+    for (std::list<CMasternodeRankTable>::iterator it = lRankTables.begin(); it != lRankTables.end(); ++it) {
+        if (it->nBlockHeight != nBlockHeight || it->minProtocol != minProtocol || it->fOnlyActive != fOnlyActive)
+            continue;
+        if (it->hashBlock != hash || nNow - it->nTimeCreated >= MASTERNODE_CHECK_SECONDS) {
+            lRankTables.erase(it);
+            break;
+        }
+        lRankTables.splice(lRankTables.begin(), lRankTables, it);
+        return &lRankTables.front();
+    }
+
     std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    // the block hash is hashed once here rather than once per masternode
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hash;
+    uint256 hashScore = ss.GetHash();
 
     // scan for winner
     for (CMasternode& mn : vMasternodes) {
@@ -659,7 +698,7 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
+        uint256 n = mn.CalculateScore(hash, hashScore);
         int64_t n2 = n.GetCompact(false);
 
         vecMasternodeScores.push_back(make_pair(n2, mn.vin));
@@ -667,49 +706,146 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
     sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
 
+    lRankTables.push_front(CMasternodeRankTable(nBlockHeight, minProtocol, fOnlyActive, hash));
+    CMasternodeRankTable& table = lRankTables.front();
     int rank = 0;
     for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
+        table.mapRanks.insert(make_pair(s.second.prevout, rank));
+    }
+
+    if (lRankTables.size() > MASTERNODE_RANK_TABLES)
+        lRankTables.pop_back();
+
+    return &table;
+}
+
+void CMasternodeMan::MasternodeListChanged()
+{
+    LOCK(cs);
+    lRankTables.clear();
+    fIndexesDirty = true;
+    pSnapshot.reset();
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    AssertLockHeld(cs);
+
+    mapIndexByOutPoint.clear();
+    mapIndexByPubKey.clear();
+    // keep the first entry on duplicates, as the linear scans did
+    for (size_t i = 0; i < vMasternodes.size(); i++) {
+        mapIndexByOutPoint.insert(make_pair(vMasternodes[i].vin.prevout, i));
+        mapIndexByPubKey.insert(make_pair(vMasternodes[i].pubKeyMasternode, i));
+    }
+    fIndexesDirty = false;
+}
+
+boost::shared_ptr<const std::vector<CMasternode> > CMasternodeMan::GetSnapshot()
+{
+    LOCK(cs);
+
+    if (!pSnapshot || GetTime() - nSnapshotTime >= MASTERNODE_CHECK_SECONDS) {
+        Check();
+        pSnapshot.reset(new std::vector<CMasternode>(vMasternodes));
+        nSnapshotTime = GetTime();
+    }
+    return pSnapshot;
+}
+
+void CMasternodeMan::CheckCollaterals()
+{
+    // Collect the collaterals first and look them up without holding cs, masternode code
+    // takes cs_main while holding cs so the two locks can't be taken in the other order
+    std::vector<COutPoint> vCollaterals;
+    {
+        LOCK(cs);
+        vCollaterals.reserve(vMasternodes.size());
+        for (CMasternode& mn : vMasternodes) {
+            if (mn.activeState != CMasternode::MASTERNODE_VIN_SPENT)
+                vCollaterals.push_back(mn.vin.prevout);
+        }
+    }
+    if (vCollaterals.empty()) return;
+
+    std::set<COutPoint> setSpent;
+    {
+        LOCK(cs_main);
+        if (pcoinsTip == NULL) return;
+
+        CCoinsViewCache cache(pcoinsTip);
+        for (const COutPoint& outpoint : vCollaterals) {
+            const CCoins* coins = cache.AccessCoins(outpoint.hash);
+            if (!coins || !coins->IsAvailable(outpoint.n) || !Params().isMasternodeCollateral(coins->vout[outpoint.n].nValue))
+                setSpent.insert(outpoint);
         }
     }
+    if (setSpent.empty()) return;
 
-    return -1;
+    LOCK(cs);
+    for (CMasternode& mn : vMasternodes) {
+        if (mn.activeState != CMasternode::MASTERNODE_VIN_SPENT && setSpent.count(mn.vin.prevout)) {
+            LogPrint("masternode", "CMasternodeMan::CheckCollaterals - collateral spent %s\n", mn.vin.prevout.ToStringShort());
+            mn.activeState = CMasternode::MASTERNODE_VIN_SPENT;
+        }
+    }
+    MasternodeListChanged();
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    const CMasternodeRankTable* pTable = GetRankTable(nBlockHeight, minProtocol, fOnlyActive);
+    if (pTable == NULL) return -1;
+
+    std::map<COutPoint, int>::const_iterator it = pTable->mapRanks.find(vin.prevout);
+    if (it == pTable->mapRanks.end()) return -1;
+
+    return it->second;
 }
 
 std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
+    std::vector<pair<int64_t, size_t> > vecMasternodeScores;
     std::vector<pair<int, CMasternode> > vecMasternodeRanks;
 
     //make sure we know about this block
     uint256 hash = 0;
     if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
 
+    // score a snapshot so that cs isn't held while the whole list is hashed
+    boost::shared_ptr<const std::vector<CMasternode> > pMasternodes = GetSnapshot();
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hash;
+    uint256 hashScore = ss.GetHash();
+
     // scan for winner
-    for (CMasternode& mn : vMasternodes) {
-        mn.Check();
+    for (size_t i = 0; i < pMasternodes->size(); i++) {
+        const CMasternode& mn = (*pMasternodes)[i];
 
         if (mn.protocolVersion < minProtocol) continue;
 
         if (!mn.IsEnabled()) {
-            vecMasternodeScores.push_back(make_pair(14999, mn));
+            vecMasternodeScores.push_back(make_pair(14999, i));
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
+        uint256 n = mn.CalculateScore(hash, hashScore);
         int64_t n2 = n.GetCompact(false);
 
-        vecMasternodeScores.push_back(make_pair(n2, mn));
+        vecMasternodeScores.push_back(make_pair(n2, i));
     }
 
     sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
 
     int rank = 0;
-    for (PAIRTYPE(int64_t, CMasternode) & s : vecMasternodeScores) {
+    vecMasternodeRanks.reserve(vecMasternodeScores.size());
+    for (PAIRTYPE(int64_t, size_t) & s : vecMasternodeScores) {
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        vecMasternodeRanks.push_back(make_pair(rank, (*pMasternodes)[s.second]));
     }
 
     return vecMasternodeRanks;
@@ -900,6 +1036,7 @@ void CMasternodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vMasternodes.erase(it);
+            MasternodeListChanged();
             break;
         }
         ++it;
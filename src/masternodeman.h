@@ -16,8 +16,14 @@
 #include "sync.h"
 #include "util.h"
 
+#include <list>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
+#define MASTERNODE_RANK_TABLES 16
 
 using namespace std;
 
@@ -50,6 +56,41 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** Masternodes ranked by score for one block, so that the rank lookups done for
+ *  every payment vote and SwiftX message don't rescore the whole list.
+ */
+class CMasternodeRankTable
+{
+public:
+    int64_t nBlockHeight;
+    int minProtocol;
+    bool fOnlyActive;
+    uint256 hashBlock;
+    int64_t nTimeCreated;
+
+    // rank of each masternode collateral, starting at 1
+    std::map<COutPoint, int> mapRanks;
+
+    CMasternodeRankTable(int64_t nBlockHeightIn, int minProtocolIn, bool fOnlyActiveIn, const uint256& hashBlockIn)
+        : nBlockHeight(nBlockHeightIn), minProtocol(minProtocolIn), fOnlyActive(fOnlyActiveIn), hashBlock(hashBlockIn), nTimeCreated(GetTime()) {}
+};
+
+struct CMasternodeOutPointHasher
+{
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        return outpoint.hash.GetLow64() ^ outpoint.n;
+    }
+};
+
+struct CMasternodePubKeyHasher
+{
+    size_t operator()(const CPubKey& pubkey) const
+    {
+        return pubkey.GetHash().GetLow64();
+    }
+};
+
 class CMasternodeMan
 {
 private:
@@ -67,6 +108,21 @@ private:
     std::map<CNetAddr, int64_t> mWeAskedForMasternodeList;
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
+    // recently used rank tables, most recent first
+    std::list<CMasternodeRankTable> lRankTables;
+    // positions in vMasternodes by collateral and by masternode key, rebuilt lazily after the list changes
+    boost::unordered_map<COutPoint, size_t, CMasternodeOutPointHasher> mapIndexByOutPoint;
+    boost::unordered_map<CPubKey, size_t, CMasternodePubKeyHasher> mapIndexByPubKey;
+    bool fIndexesDirty;
+    // copy of the list handed out to readers, so they don't hold cs while they work on it
+    boost::shared_ptr<const std::vector<CMasternode> > pSnapshot;
+    int64_t nSnapshotTime;
+
+    /// Rebuild mapIndexByOutPoint and mapIndexByPubKey, requires cs
+    void RebuildIndexes();
+
+    /// Find or build the rank table for a block, requires cs
+    const CMasternodeRankTable* GetRankTable(int64_t nBlockHeight, int minProtocol, bool fOnlyActive);
 
 public:
     // Keep track of all broadcasts I've seen
@@ -91,6 +147,9 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+
+        if (ser_action.ForRead())
+            MasternodeListChanged();
     }
 
     CMasternodeMan();
@@ -135,16 +194,24 @@ public:
     CMasternode* GetCurrentMasterNode(int mod = 1, int64_t nBlockHeight = 0, int minProtocol = 0);
     CMasternode* GetCurrentMasternodeOnLevel (unsigned int masternodeLevel, int mod = 1, int64_t nBlockHeight = 0, int minProtocol = 0);
 
+    /// Get a checked copy of the masternode list that stays valid without holding cs
+    boost::shared_ptr<const std::vector<CMasternode> > GetSnapshot();
+
     std::vector<CMasternode> GetFullMasternodeVector()
     {
-        Check();
-        return vMasternodes;
+        return *GetSnapshot();
     }
 
     std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol = 0);
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
 
+    /// Drop the rank tables, indexes and snapshot derived from the masternode list
+    void MasternodeListChanged();
+
+    /// Mark masternodes whose collateral is no longer in the UTXO set, once per connected block
+    void CheckCollaterals();
+
     void ProcessMasternodeConnections();
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
@@ -91,6 +91,199 @@ public:
 	}
 };
 
+/** What CreateNewBlock needs to know about a mempool transaction, apart from its height dependent priority */
+struct CMinerTxInfo {
+	const CTransaction* ptx;
+	bool fValid;                     //! inputs exist, are not invalid outpoints and pass the mandatory script checks
+	CAmount nValueIn;                //! value of all inputs, including those from mempool parents
+	CAmount nValueConfirmed;         //! value of the inputs that are in the chain
+	double dValueHeight;             //! sum of value * height of the inputs that are in the chain
+	unsigned int nTxSize;
+	unsigned int nSigOps;            //! legacy and P2SH sigops
+	std::set<uint256> setDependsOn;  //! mempool parents
+
+	CMinerTxInfo() : ptx(NULL), fValid(false), nValueIn(0), nValueConfirmed(0), dValueHeight(0), nTxSize(0), nSigOps(0) {}
+};
+
+/**
+ * Caches the input lookups and script checks CreateNewBlock does on every
+ * mempool transaction. Entries are computed once when a transaction enters
+ * the pool and refreshed when one of its parents leaves it, so that a new
+ * template only costs lookups for what changed since the previous one.
+ * Priorities are derived from the cached input heights at each call.
+ */
+class CMinerTxCache : public CValidationInterface
+{
+public:
+	mutable CCriticalSection cs;
+	std::map<uint256, CMinerTxInfo> mapTx;
+
+	CMinerTxCache() : pindexLast(NULL), fReorg(false), fListening(false) {}
+
+	void SetListening(bool fListeningIn)
+	{
+		LOCK(cs);
+		fListening = fListeningIn;
+		pindexLast = NULL;
+	}
+
+	/** Bring mapTx in line with the mempool; needs cs_main and mempool.cs */
+	void Update()
+	{
+		AssertLockHeld(cs_main);
+		AssertLockHeld(mempool.cs);
+		LOCK(cs);
+
+		// Without notifications, or after a reorg changed the heights of inputs, start over
+		if (!fListening || fReorg || pindexLast == NULL || !chainActive.Contains(pindexLast)) {
+			mapTx.clear();
+			mapChildren.clear();
+			setDirty.clear();
+			for (CTxMemPool::indexed_transaction_set::const_iterator it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+				setDirty.insert(it->GetTx().GetHash());
+			fReorg = false;
+		} else if (pindexLast != chainActive.Tip()) {
+			// Coins that were immature may be spendable now
+			for (std::map<uint256, CMinerTxInfo>::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it) {
+				if (!it->second.fValid)
+					setDirty.insert(it->first);
+			}
+		}
+		pindexLast = chainActive.Tip();
+
+		if (setDirty.empty())
+			return;
+
+		CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+		CCoinsViewCache view(&viewMemPool);
+		BOOST_FOREACH (const uint256& hash, setDirty) {
+			Erase(hash);
+			CTxMemPool::indexed_transaction_set::const_iterator it = mempool.mapTx.find(hash);
+			if (it == mempool.mapTx.end())
+				continue;
+
+			CMinerTxInfo& info = mapTx[hash];
+			Compute(it->GetTx(), view, info);
+			BOOST_FOREACH (const uint256& hashParent, info.setDependsOn)
+				mapChildren[hashParent].insert(hash);
+		}
+		LogPrint("mempool", "%s : refreshed %u of %u transactions\n", __func__, setDirty.size(), mapTx.size());
+		setDirty.clear();
+	}
+
+protected:
+	void TransactionAddedToMempool(const CTransaction& tx)
+	{
+		LOCK(cs);
+		setDirty.insert(tx.GetHash());
+	}
+
+	void TransactionRemovedFromMempool(const CTransaction& tx)
+	{
+		LOCK(cs);
+		const uint256 hash = tx.GetHash();
+		// Children now spend confirmed outputs, or are on their way out as well
+		std::map<uint256, std::set<uint256> >::iterator it = mapChildren.find(hash);
+		if (it != mapChildren.end())
+			setDirty.insert(it->second.begin(), it->second.end());
+		Erase(hash);
+		setDirty.erase(hash);
+	}
+
+	void UpdatedBlockTip(const CBlockIndex* pindex)
+	{
+		LOCK(cs);
+		if (pindexLast && pindex->GetAncestor(pindexLast->nHeight) != pindexLast)
+			fReorg = true;
+	}
+
+private:
+	std::map<uint256, std::set<uint256> > mapChildren;
+	std::set<uint256> setDirty;
+	const CBlockIndex* pindexLast;
+	bool fReorg;
+	bool fListening;
+
+	void Erase(const uint256& hash)
+	{
+		std::map<uint256, CMinerTxInfo>::iterator it = mapTx.find(hash);
+		if (it == mapTx.end())
+			return;
+		BOOST_FOREACH (const uint256& hashParent, it->second.setDependsOn) {
+			std::map<uint256, std::set<uint256> >::iterator itParent = mapChildren.find(hashParent);
+			if (itParent != mapChildren.end()) {
+				itParent->second.erase(hash);
+				if (itParent->second.empty())
+					mapChildren.erase(itParent);
+			}
+		}
+		mapTx.erase(it);
+	}
+
+	void Compute(const CTransaction& tx, CCoinsViewCache& view, CMinerTxInfo& info)
+	{
+		info.ptx = &tx;
+		info.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+		info.nSigOps = GetLegacySigOpCount(tx);
+
+		if (tx.IsZerocoinSpend()) {
+			info.nValueIn = tx.GetZerocoinSpent();
+			info.fValid = true;
+			return;
+		}
+
+		for (const CTxIn& txin : tx.vin) {
+			// This should never happen; all transactions in the memory
+			// pool should connect to either transactions in the chain
+			// or other transactions in the memory pool.
+			const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+			if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+				LogPrintf("ERROR: mempool transaction missing input\n");
+				if (fDebug) assert("mempool transaction missing input" == 0);
+				return;
+			}
+
+			//Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+			if (invalid_out::ContainsOutPoint(txin.prevout)) {
+				LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+				return;
+			}
+
+			CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+			info.nValueIn += nValueIn;
+			if (coins->nHeight == (int)MEMPOOL_HEIGHT) {
+				// Has to wait for dependencies
+				info.setDependsOn.insert(txin.prevout.hash);
+			} else {
+				info.nValueConfirmed += nValueIn;
+				info.dValueHeight += (double)nValueIn * coins->nHeight;
+			}
+		}
+
+		info.nSigOps += GetP2SHSigOpCount(tx, view);
+
+		// Note that flags: we don't want to set mempool/IsStandard()
+		// policy here, but we still have to ensure that the block we
+		// create only contains transactions that are valid in new blocks.
+		CValidationState state;
+		info.fValid = CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true);
+	}
+};
+
+static CMinerTxCache minerTxCache;
+
+void RegisterMinerTxCache()
+{
+	minerTxCache.SetListening(true);
+	RegisterValidationInterface(&minerTxCache);
+}
+
+void UnregisterMinerTxCache()
+{
+	UnregisterValidationInterface(&minerTxCache);
+	minerTxCache.SetListening(false);
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
 	pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -192,115 +385,75 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 		map<uint256, vector<COrphan*> > mapDependers;
 		bool fPrintPriority = GetBoolArg("-printpriority", false);
 
+		// Only the transactions that changed since the last template need their inputs looked up
+		LOCK(minerTxCache.cs);
+		minerTxCache.Update();
+
 		// This vector will be sorted into a priority queue:
 		vector<TxPriority> vecPriority;
-		vecPriority.reserve(mempool.mapTx.size());
-		for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-			mi != mempool.mapTx.end(); ++mi) {
-			const CTransaction& tx = mi->second.GetTx();
-			if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)) {
+		vecPriority.reserve(minerTxCache.mapTx.size());
+		for (map<uint256, CMinerTxInfo>::const_iterator mi = minerTxCache.mapTx.begin();
+			mi != minerTxCache.mapTx.end(); ++mi) {
+			const CMinerTxInfo& info = mi->second;
+			const CTransaction& tx = *info.ptx;
+			if (!info.fValid || !IsFinalTx(tx, nHeight)) {
 				continue;
 			}
 			if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()) {
 				continue;
 			}
 
-			COrphan* porphan = NULL;
 			double dPriority = 0;
-			CAmount nTotalIn = 0;
-			bool fMissingInputs = false;
-			uint256 txid = tx.GetHash();
-			for (const CTxIn& txin : tx.vin) {
-				//zerocoinspend has special vin
-				if (tx.IsZerocoinSpend()) {
-					nTotalIn = tx.GetZerocoinSpent();
-
-					//Give a high priority to zerocoinspends to get into the next block
-					//Priority = (age^6+100000)*amount - gives higher priority to zdeqs that have been in mempool long
-					//and higher priority to zdeqs that are large in value
-					int64_t nTimeSeen = GetAdjustedTime();
-					double nConfs = 100000;
-
-					auto it = mapZerocoinspends.find(txid);
-					if (it != mapZerocoinspends.end()) {
-						nTimeSeen = it->second;
-					}
-					else {
-						//for some reason not in map, add it
-						mapZerocoinspends[txid] = nTimeSeen;
-					}
-
-					double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
-
-					// zdeq spends can have very large priority, use non-overflowing safe functions
-					dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
-					dPriority = double_safe_multiplication(dPriority, nTotalIn);
-
-					continue;
-				}
-
-				// Read prev transaction
-				if (!view.HaveCoins(txin.prevout.hash)) {
-					// This should never happen; all transactions in the memory
-					// pool should connect to either transactions in the chain
-					// or other transactions in the memory pool.
-					if (!mempool.mapTx.count(txin.prevout.hash)) {
-						LogPrintf("ERROR: mempool transaction missing input\n");
-						if (fDebug) assert("mempool transaction missing input" == 0);
-						fMissingInputs = true;
-						if (porphan)
-							vOrphan.pop_back();
-						break;
-					}
-
-					// Has to wait for dependencies
-					if (!porphan) {
-						// Use list for automatic deletion
-						vOrphan.push_back(COrphan(&tx));
-						porphan = &vOrphan.back();
-					}
-					mapDependers[txin.prevout.hash].push_back(porphan);
-					porphan->setDependsOn.insert(txin.prevout.hash);
-					nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-					continue;
+			CAmount nTotalIn = info.nValueIn;
+			const uint256& txid = mi->first;
+			if (tx.IsZerocoinSpend()) {
+				//Give a high priority to zerocoinspends to get into the next block
+				//Priority = (age^6+100000)*amount - gives higher priority to zdeqs that have been in mempool long
+				//and higher priority to zdeqs that are large in value
+				int64_t nTimeSeen = GetAdjustedTime();
+				double nConfs = 100000;
+
+				auto it = mapZerocoinspends.find(txid);
+				if (it != mapZerocoinspends.end()) {
+					nTimeSeen = it->second;
 				}
-
-				//Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-				if (invalid_out::ContainsOutPoint(txin.prevout)) {
-					LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-					fMissingInputs = true;
-					break;
+				else {
+					//for some reason not in map, add it
+					mapZerocoinspends[txid] = nTimeSeen;
 				}
 
-				const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-				assert(coins);
-
-				CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-				nTotalIn += nValueIn;
-
-				int nConf = nHeight - coins->nHeight;
+				double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
 
 				// zdeq spends can have very large priority, use non-overflowing safe functions
-				dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
+				for (unsigned int i = 0; i < tx.vin.size(); i++) {
+					dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
+					dPriority = double_safe_multiplication(dPriority, nTotalIn);
+				}
+			}
+			else {
+				// sum(valuein * age) over the inputs in the chain
+				dPriority = (double)info.nValueConfirmed * nHeight - info.dValueHeight;
 			}
-			if (fMissingInputs) continue;
 
 			// Priority is sum(valuein * age) / modified_txsize
-			unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-			dPriority = tx.ComputePriority(dPriority, nTxSize);
+			dPriority = tx.ComputePriority(dPriority, info.nTxSize);
 
-			uint256 hash = tx.GetHash();
-			mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+			mempool.ApplyDeltas(txid, dPriority, nTotalIn);
 
-			CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
+			CFeeRate feeRate(nTotalIn - tx.GetValueOut(), info.nTxSize);
 
-			if (porphan) {
+			if (!info.setDependsOn.empty()) {
+				// Has to wait for dependencies
+				vOrphan.push_back(COrphan(&tx));
+				COrphan* porphan = &vOrphan.back();
+				porphan->setDependsOn = info.setDependsOn;
 				porphan->dPriority = dPriority;
 				porphan->feeRate = feeRate;
+				BOOST_FOREACH (const uint256& hashParent, info.setDependsOn)
+					mapDependers[hashParent].push_back(porphan);
 			}
 			else
-				vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+				vecPriority.push_back(TxPriority(dPriority, feeRate, &tx));
 		}
 
 		// Collect transactions into block
@@ -323,19 +476,21 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 			std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
 			vecPriority.pop_back();
 
+			const uint256& hash = tx.GetHash();
+			const CMinerTxInfo& info = minerTxCache.mapTx.find(hash)->second;
+
 			// Size limits
-			unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+			unsigned int nTxSize = info.nTxSize;
 			if (nBlockSize + nTxSize >= nBlockMaxSize)
 				continue;
 
-			// Legacy limits on sigOps:
+			// Limits on sigOps:
 			unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-			unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+			unsigned int nTxSigOps = info.nSigOps;
 			if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
 				continue;
 
 			// Skip free transactions if we're past the minimum block size:
-			const uint256& hash = tx.GetHash();
 			double dPriorityDelta = 0;
 			CAmount nFeeDelta = 0;
 			mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
@@ -381,19 +536,10 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 					continue;
 			}
 
-			CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+			// Inputs and scripts were checked when the transaction entered the cache
+			CAmount nTxFees = info.nValueIn - tx.GetValueOut();
 
-			nTxSigOps += GetP2SHSigOpCount(tx, view);
-			if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-				continue;
-
-			// Note that flags: we don't want to set mempool/IsStandard()
-			// policy here, but we still have to ensure that the block we
-			// create only contains transactions that are valid in new blocks.
 			CValidationState state;
-			if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-				continue;
-
 			CTxUndo txundo;
 			UpdateCoins(tx, state, view, txundo, nHeight);
 
@@ -27,6 +27,9 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet,
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
+/** Keep the mempool data CreateNewBlock needs up to date between calls, from mempool and tip notifications */
+void RegisterMinerTxCache();
+void UnregisterMinerTxCache();
 
 void BitcoinMiner(CWallet* pwallet, bool fProofOfStake);
 
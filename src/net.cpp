@@ -20,6 +20,7 @@
 #include "obfuscation.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "socketevents.h"
 #include "ui_interface.h"
 #include "wallet.h"
 
@@ -36,6 +37,9 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#include <cmath>
+#include <limits>
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -86,6 +90,8 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = 125;
+int nMessageWorkers = 0;
+CNetMessageBufferPool recvBufferPool;
 bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
@@ -108,7 +114,17 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
+
+// Readiness notification for ThreadSocketHandler, created in StartNode
+static CSocketEvents* psocketEvents = NULL;
+// Listen sockets are watched as LISTEN_SOCKET_EVENT_ID - index, far away from any node id
+static const uint64_t LISTEN_SOCKET_EVENT_ID = std::numeric_limits<uint64_t>::max();
+
 boost::condition_variable messageHandlerCondition;
+static boost::condition_variable messageWorkerCondition;
+
+static CCriticalSection cs_mapMessageTimes;
+static std::map<std::string, CMessageTimeHistogram> mapMessageTimes;
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -415,7 +431,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (psocketEvents ? !psocketEvents->CanWatch(hSocket) : !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -684,7 +700,13 @@ void CNode::copyStats(CNodeStats& stats)
     X(nStartingHeight);
     X(nSendBytes);
     X(nRecvBytes);
+    stats.dSendRate = sendRate.GetRate();
+    stats.dRecvRate = recvRate.GetRate();
     X(fWhitelisted);
+    {
+        LOCK(cs_vSend);
+        X(mapSendBytesPerMsgCmd);
+    }
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -706,6 +728,62 @@ void CNode::copyStats(CNodeStats& stats)
 }
 #undef X
 
+// seconds over which CRateMeter smooths the transfer rate
+static const double RATE_METER_WINDOW = 10.0;
+
+void CRateMeter::Update(uint64_t nTotalBytes, int64_t nTimeMicros)
+{
+    if (nLastTime != 0 && nTimeMicros - nLastTime < 1000000)
+        return;
+    if (nLastTime != 0) {
+        double dSeconds = 0.000001 * (nTimeMicros - nLastTime);
+        double dWeight = 1.0 - exp(-dSeconds / RATE_METER_WINDOW);
+        dRate += dWeight * ((nTotalBytes - nLastTotalBytes) / dSeconds - dRate);
+    }
+    nLastTotalBytes = nTotalBytes;
+    nLastTime = nTimeMicros;
+}
+
+CMessageTimeHistogram::CMessageTimeHistogram() : fWorkerLane(false), nCount(0), nTotalMicros(0), nMaxMicros(0)
+{
+    memset(vBuckets, 0, sizeof(vBuckets));
+}
+
+int CMessageTimeHistogram::GetBucket(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < BUCKETS - 1 && nMicros >= ((int64_t)1 << nBucket))
+        nBucket++;
+    return nBucket;
+}
+
+void CMessageTimeHistogram::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    vBuckets[GetBucket(nMicros)]++;
+}
+
+void RecordMessageTime(const std::string& strCommand, int64_t nMicros, bool fWorkerLane)
+{
+    LOCK(cs_mapMessageTimes);
+    std::map<std::string, CMessageTimeHistogram>::iterator it = mapMessageTimes.find(strCommand);
+    if (it == mapMessageTimes.end()) {
+        // peers can make up commands, don't let them grow the map without bound
+        std::string strKey = mapMessageTimes.size() < MAX_MESSAGE_TIME_COMMANDS ? strCommand : "other";
+        it = mapMessageTimes.insert(std::make_pair(strKey, CMessageTimeHistogram())).first;
+    }
+    it->second.fWorkerLane = fWorkerLane;
+    it->second.Add(nMicros);
+}
+
+std::map<std::string, CMessageTimeHistogram> GetMessageTimes()
+{
+    LOCK(cs_mapMessageTimes);
+    return mapMessageTimes;
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 {
@@ -744,22 +822,79 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
     return true;
 }
 
+void CNetMessageBufferPool::Get(CSerializeData& data, size_t nCapacity)
+{
+    CSerializeData().swap(data);
+    {
+        LOCK(cs);
+        // smallest buffer that is big enough
+        std::vector<CSerializeData>::iterator itBest = vFree.end();
+        for (std::vector<CSerializeData>::iterator it = vFree.begin(); it != vFree.end(); ++it) {
+            if (it->capacity() >= nCapacity && (itBest == vFree.end() || it->capacity() < itBest->capacity()))
+                itBest = it;
+        }
+        if (itBest != vFree.end()) {
+            nFreeBytes -= itBest->capacity();
+            data.swap(*itBest);
+            itBest->swap(vFree.back());
+            vFree.pop_back();
+            return;
+        }
+    }
+    data.reserve(nCapacity);
+}
+
+void CNetMessageBufferPool::Put(CSerializeData& data)
+{
+    CSerializeData vch;
+    vch.swap(data);
+    if (vch.capacity() == 0)
+        return;
+    vch.clear();
+
+    LOCK(cs);
+    if (vFree.size() >= MAX_POOLED_RECV_BUFFERS || nFreeBytes + vch.capacity() > MAX_POOLED_RECV_BYTES)
+        return;
+    nFreeBytes += vch.capacity();
+    vFree.push_back(CSerializeData());
+    vFree.back().swap(vch);
+}
+
+size_t CNetMessageBufferPool::GetFreeCount()
+{
+    LOCK(cs);
+    return vFree.size();
+}
+
+size_t CNetMessageBufferPool::GetFreeBytes()
+{
+    LOCK(cs);
+    return nFreeBytes;
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData data;
+    vRecv.SwapBuffer(data);
+    recvBufferPool.Put(data);
+}
+
 int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        CSpanReader(hdrbuf, hdrbuf + CMessageHeader::HEADER_SIZE, vRecv.nType, vRecv.nVersion) >> hdr;
     } catch (const std::exception&) {
         return -1;
     }
@@ -771,6 +906,16 @@ int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    if (hdr.nMessageSize == 0) {
+        hasher.Finalize(data_hash.begin());
+    } else if (hdr.nMessageSize <= MAX_PROTOCOL_MESSAGE_LENGTH) {
+        // take a buffer for the whole payload, oversized messages get the peer disconnected anyway
+        CSerializeData data;
+        recvBufferPool.Get(data, hdr.nMessageSize);
+        vRecv.SwapBuffer(data);
+        recvBufferPool.Put(data);
+    }
+
     return nCopy;
 }
 
@@ -779,14 +924,14 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
-
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // the buffer was reserved for the whole payload in readHeader, appending doesn't reallocate
+    vRecv.write(pch, nCopy);
+    hasher.Write((const unsigned char*)pch, nCopy);
     nDataPos += nCopy;
 
+    if (nDataPos == hdr.nMessageSize)
+        hasher.Finalize(data_hash.begin());
+
     return nCopy;
 }
 
@@ -839,6 +984,8 @@ static list<CNode*> vNodesDisconnected;
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    // typical socket buffer is 8K-64K
+    std::vector<char> vRecvBuffer(0x10000);
     while (true) {
         //
         // Disconnect nodes
@@ -904,42 +1051,23 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+        for (size_t i = 0; i < vhListenSocket.size(); i++)
+            psocketEvents->Watch(vhListenSocket[i].socket, LISTEN_SOCKET_EVENT_ID - i, CSocketEvents::EVENT_RECV);
 
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
 
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -947,43 +1075,36 @@ void ThreadSocketHandler()
                 // * We send some data.
                 // * We wait for data to be received (and disconnect after timeout).
                 // * We process a message in the buffer (message handler thread).
+                // Errors are reported either way.
+                int nEvents = 0;
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
+                    if (lockSend && !pnode->vSendMsg.empty())
+                        nEvents = CSocketEvents::EVENT_SEND;
                 }
-                {
+                if (nEvents == 0) {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                     if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
                                         pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                        nEvents = CSocketEvents::EVENT_RECV;
                 }
+                psocketEvents->Watch(pnode->hSocket, pnode->GetId(), nEvents);
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        // frequency to poll pnode->vSend
+        std::vector<std::pair<uint64_t, int> > vReady;
+        psocketEvents->Wait(50, vReady);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
-        }
+        std::map<uint64_t, int> mapReady(vReady.begin(), vReady.end());
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+        for (size_t i = 0; i < vhListenSocket.size(); i++) {
+            const ListenSocket& hListenSocket = vhListenSocket[i];
+            if (hListenSocket.socket != INVALID_SOCKET && mapReady.count(LISTEN_SOCKET_EVENT_ID - i)) {
                 struct sockaddr_storage sockaddr;
                 socklen_t len = sizeof(sockaddr);
                 SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
@@ -1006,7 +1127,9 @@ void ThreadSocketHandler()
                     int nErr = WSAGetLastError();
                     if (nErr != WSAEWOULDBLOCK)
                         LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
+                    else
+                        psocketEvents->Drained(LISTEN_SOCKET_EVENT_ID - i, CSocketEvents::EVENT_RECV);
+                } else if (!psocketEvents->CanWatch(hSocket)) {
                     LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
                     CloseSocket(hSocket);
                 } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
@@ -1041,24 +1164,28 @@ void ThreadSocketHandler()
         BOOST_FOREACH (CNode* pnode, vNodesCopy) {
             boost::this_thread::interruption_point();
 
+            std::map<uint64_t, int>::const_iterator itReady = mapReady.find(pnode->GetId());
+            int nReady = itReady != mapReady.end() ? itReady->second : 0;
+
             //
             // Receive
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            if (nReady & (CSocketEvents::EVENT_RECV | CSocketEvents::EVENT_ERROR)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv) {
                     {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                        int nBytes = recv(pnode->hSocket, &vRecvBuffer[0], vRecvBuffer.size(), MSG_DONTWAIT);
                         if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                            if (!pnode->ReceiveMsgBytes(&vRecvBuffer[0], nBytes))
                                 pnode->CloseSocketDisconnect();
                             pnode->nLastRecv = GetTime();
                             pnode->nRecvBytes += nBytes;
                             pnode->RecordBytesRecv(nBytes);
+                            // a short read emptied the socket buffer, the next data raises a new event
+                            if ((size_t)nBytes < vRecvBuffer.size())
+                                psocketEvents->Drained(pnode->GetId(), CSocketEvents::EVENT_RECV);
                         } else if (nBytes == 0) {
                             // socket closed gracefully
                             if (!pnode->fDisconnect)
@@ -1071,6 +1198,8 @@ void ThreadSocketHandler()
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
                                 pnode->CloseSocketDisconnect();
+                            } else if (nErr == WSAEWOULDBLOCK) {
+                                psocketEvents->Drained(pnode->GetId(), CSocketEvents::EVENT_RECV);
                             }
                         }
                     }
@@ -1082,12 +1211,20 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            if (nReady & CSocketEvents::EVENT_SEND) {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
                     SocketSendData(pnode);
+                    // whatever is left did not fit into the socket buffer
+                    if (!pnode->vSendMsg.empty())
+                        psocketEvents->Drained(pnode->GetId(), CSocketEvents::EVENT_SEND);
+                }
             }
 
+            int64_t nTimeMicros = GetTimeMicros();
+            pnode->recvRate.Update(pnode->nRecvBytes, nTimeMicros);
+            pnode->sendRate.Update(pnode->nSendBytes, nTimeMicros);
+
             //
             // Inactivity checking
             //
@@ -1557,6 +1694,53 @@ void ThreadMessageHandler()
     }
 }
 
+void WakeMessageWorkers()
+{
+    messageWorkerCondition.notify_all();
+}
+
+// Processes the messages ProcessMessages handed to the worker lane. Each worker takes the
+// next message of every node that no other worker is busy with, so a node's messages
+// are still processed one at a time and in order.
+void ThreadMessageWorker()
+{
+    boost::mutex condition_mutex;
+    boost::unique_lock<boost::mutex> lock(condition_mutex);
+
+    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    while (true) {
+        vector<CNode*> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy = vNodes;
+            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+                pnode->AddRef();
+            }
+        }
+
+        bool fSleep = true;
+
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            g_signals.ProcessWorkerMessages(pnode);
+            {
+                LOCK(pnode->cs_vRecvMsgWorker);
+                if (!pnode->vRecvMsgWorker.empty() && !pnode->fRecvMsgWorkerBusy)
+                    fSleep = false;
+            }
+            boost::this_thread::interruption_point();
+        }
+
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                pnode->Release();
+        }
+
+        if (fSleep)
+            messageWorkerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+    }
+}
+
 // ppcoin: stake minter thread
 void static ThreadStakeMinter()
 {
@@ -1743,6 +1927,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+    if (psocketEvents == NULL) {
+        psocketEvents = new CSocketEvents(GetArg("-socketevents", DEFAULT_SOCKET_EVENTS) != "select");
+        LogPrintf("Using %s for socket events\n", psocketEvents->GetBackendName());
+    }
+
     Discover(threadGroup);
 
     //
@@ -1769,6 +1958,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Process messages
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
+    // Process the messages that don't need cs_main
+    nMessageWorkers = std::max(0, std::min((int)GetArg("-msgworkers", DEFAULT_MESSAGE_WORKERS), MAX_MESSAGE_WORKERS));
+    for (int i = 0; i < nMessageWorkers; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msgworker", &ThreadMessageWorker));
+
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
 
@@ -1821,6 +2015,8 @@ public:
         semOutbound = NULL;
         delete pnodeLocalHost;
         pnodeLocalHost = NULL;
+        delete psocketEvents;
+        psocketEvents = NULL;
 
 #ifdef WIN32
         // Shutdown Windows Sockets
@@ -2075,6 +2271,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
+    nRecvMsgWorkerSize = 0;
+    fRecvMsgWorkerBusy = false;
     nSendSize = 0;
     nSendOffset = 0;
     hashContinue = 0;
@@ -2163,7 +2361,7 @@ void CNode::AbortMessage() UNLOCK_FUNCTION(cs_vSend)
     LogPrint("net", "(aborted)\n");
 }
 
-void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
+void CNode::EndMessage(const unsigned int* pnChecksum) UNLOCK_FUNCTION(cs_vSend)
 {
     // The -*messagestest options are intentionally not documented in the help message,
     // since they are only used during development to debug the networking code and are
@@ -2173,8 +2371,10 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         AbortMessage();
         return;
     }
-    if (mapArgs.count("-fuzzmessagestest"))
+    if (mapArgs.count("-fuzzmessagestest")) {
         Fuzz(GetArg("-fuzzmessagestest", 10));
+        pnChecksum = NULL;
+    }
 
     if (ssSend.size() == 0) {
 	    LEAVE_CRITICAL_SECTION(cs_vSend);
@@ -2186,14 +2386,16 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
 
     // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    unsigned int nChecksum = pnChecksum ? *pnChecksum : GetMessageChecksum(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
     assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
     memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
+    CMessageHeader hdr;
+    memcpy(hdr.pchCommand, &ssSend[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE);
+    mapSendBytesPerMsgCmd[hdr.GetCommand()] += ssSend.size();
+
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
@@ -2205,6 +2407,19 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+void CNode::PushRawMessage(const char* pszCommand, const std::vector<unsigned char>& vchPayload, unsigned int nChecksum)
+{
+    try {
+        BeginMessage(pszCommand);
+        if (!vchPayload.empty())
+            ssSend.write((const char*)&vchPayload[0], vchPayload.size());
+        EndMessage(&nChecksum);
+    } catch (...) {
+        AbortMessage();
+        throw;
+    }
+}
+
 //
 // CBanDB
 //
@@ -63,6 +63,18 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** Default for -socketevents, the readiness backend of the socket handler thread (epoll or select) */
+static const char* const DEFAULT_SOCKET_EVENTS = "epoll";
+/** Default for -msgworkers, the threads processing the messages that don't need cs_main */
+static const int DEFAULT_MESSAGE_WORKERS = 2;
+/** Maximum for -msgworkers */
+static const int MAX_MESSAGE_WORKERS = 16;
+/** At most this many payload buffers of received messages are kept for reuse */
+static const size_t MAX_POOLED_RECV_BUFFERS = 128;
+/** At most this many bytes of payload buffers are kept for reuse */
+static const size_t MAX_POOLED_RECV_BYTES = 16 * 1024 * 1024;
+/** Processing time histograms are kept for at most this many distinct commands, the rest are accounted as "other" */
+static const size_t MAX_MESSAGE_TIME_COMMANDS = 64;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -82,6 +94,18 @@ bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
+/** Let the message workers know that a node has messages queued for them */
+void WakeMessageWorkers();
+
+/** The checksum carried in the header of a message with this payload */
+template <typename T>
+unsigned int GetMessageChecksum(const T pbegin, const T pend)
+{
+    uint256 hash = Hash(pbegin, pend);
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    return nChecksum;
+}
 
 typedef int NodeId;
 
@@ -89,6 +113,7 @@ typedef int NodeId;
 struct CNodeSignals {
     boost::signals2::signal<int()> GetHeight;
     boost::signals2::signal<bool(CNode*)> ProcessMessages;
+    boost::signals2::signal<void(CNode*)> ProcessWorkerMessages;
     boost::signals2::signal<bool(CNode*, bool)> SendMessages;
     boost::signals2::signal<void(NodeId, const CNode*)> InitializeNode;
     boost::signals2::signal<void(NodeId)> FinalizeNode;
@@ -130,6 +155,7 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern int nMessageWorkers;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -152,6 +178,8 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+typedef std::map<std::string, uint64_t> mapMsgCmdSize; //command, total bytes
+
 class CNodeStats
 {
 public:
@@ -167,36 +195,111 @@ public:
     bool fInbound;
     int nStartingHeight;
     uint64_t nSendBytes;
+    mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    double dSendRate;
+    double dRecvRate;
+};
+
+/** Transfer rate of one direction of a connection in bytes per second, smoothed over about ten seconds */
+class CRateMeter
+{
+private:
+    double dRate;
+    uint64_t nLastTotalBytes;
+    int64_t nLastTime;
+
+public:
+    CRateMeter() : dRate(0), nLastTotalBytes(0), nLastTime(0) {}
+
+    /** Account for the byte counter nTotalBytes at nTimeMicros, at most once a second */
+    void Update(uint64_t nTotalBytes, int64_t nTimeMicros);
+    double GetRate() const { return dRate; }
+};
+
+/** Distribution of the time spent processing one message command */
+class CMessageTimeHistogram
+{
+public:
+    /** Bucket i counts the messages that took less than 2^i microseconds, the last one the rest */
+    static const int BUCKETS = 24;
+
+    bool fWorkerLane;
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[BUCKETS];
+
+    CMessageTimeHistogram();
+
+    void Add(int64_t nMicros);
+    static int GetBucket(int64_t nMicros);
 };
 
+/** Account nMicros of processing time to strCommand */
+void RecordMessageTime(const std::string& strCommand, int64_t nMicros, bool fWorkerLane);
+/** Snapshot of the processing time histograms by command */
+std::map<std::string, CMessageTimeHistogram> GetMessageTimes();
+
+/**
+ * Payload buffers of received messages, shared by all peers. A message takes a buffer
+ * big enough for its whole payload once its header is in and gives it back when it is
+ * destroyed, so most messages are received without allocating.
+ */
+class CNetMessageBufferPool
+{
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vFree;
+    size_t nFreeBytes;
+
+public:
+    CNetMessageBufferPool() : nFreeBytes(0) {}
+
+    /** Replace data with an empty buffer that has room for at least nCapacity bytes */
+    void Get(CSerializeData& data, size_t nCapacity);
+    /** Keep data for reuse if there is room in the pool, leaves data empty either way */
+    void Put(CSerializeData& data);
+
+    size_t GetFreeCount();
+    size_t GetFreeBytes();
+};
+
+extern CNetMessageBufferPool recvBufferPool;
+
 
 class CNetMessage
 {
 public:
     bool in_data; // parsing header (false) or data (true)
 
-    CDataStream hdrbuf; // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr; // complete header
     unsigned int nHdrPos;
 
     CDataStream vRecv; // received message data
     unsigned int nDataPos;
+    CHash256 hasher; // hash of the data received so far
+    uint256 data_hash; // hash of the complete data, see GetMessageHash()
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
-    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
+    CNetMessage(int nTypeIn, int nVersionIn) : vRecv(nTypeIn, nVersionIn)
     {
-        hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(const CNetMessage&) = default;
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(const CNetMessage&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -207,10 +310,16 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
+    /** Double SHA256 of the data, which the header checksum is taken from. Requires complete() */
+    const uint256& GetMessageHash() const
+    {
+        assert(complete());
+        return data_hash;
+    }
+
     int readHeader(const char* pch, unsigned int nBytes);
     int readData(const char* pch, unsigned int nBytes);
 };
@@ -291,12 +400,21 @@ public:
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
+    mapMsgCmdSize mapSendBytesPerMsgCmd; // bytes queued per message command, protected by cs_vSend
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Messages handed to the worker lane, in the order they were received. Only one worker
+    // processes a node at a time (fRecvMsgWorkerBusy); all protected by cs_vRecvMsgWorker.
+    std::deque<CNetMessage> vRecvMsgWorker;
+    size_t nRecvMsgWorkerSize;
+    bool fRecvMsgWorkerBusy;
+    CCriticalSection cs_vRecvMsgWorker;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    CRateMeter sendRate;
+    CRateMeter recvRate;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -359,6 +477,7 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     mruset<CAddress> setAddrKnown;
+    CCriticalSection cs_vAddrToSend; // protects vAddrToSend and setAddrKnown
     bool fGetAddr;
     std::set<uint256> setKnown;
 
@@ -438,6 +557,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         setAddrKnown.insert(addr);
     }
 
@@ -446,6 +566,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !setAddrKnown.count(addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -482,7 +603,11 @@ public:
     void AbortMessage() UNLOCK_FUNCTION(cs_vSend);
 
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
-    void EndMessage() UNLOCK_FUNCTION(cs_vSend);
+    // pnChecksum may point to the payload's checksum if it is already known.
+    void EndMessage(const unsigned int* pnChecksum = NULL) UNLOCK_FUNCTION(cs_vSend);
+
+    /** Send a message whose payload was serialized beforehand, with its checksum from GetMessageChecksum */
+    void PushRawMessage(const char* pszCommand, const std::vector<unsigned char>& vchPayload, unsigned int nChecksum);
 
     void PushVersion();
 
@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
+#include "kernel.h"
 #include "main.h"
 #include "masternode-sync.h"
 #include "net.h"
@@ -545,6 +546,48 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmemoryinfo\n"
+            "\nReturns an object containing information about memory usage.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"blockindex\": {                   (json object) The in-memory block index\n"
+            "    \"entries\": xxxxx,               (numeric) Number of block index entries\n"
+            "    \"entrysize\": xxxxx,             (numeric) Size of one entry in bytes\n"
+            "    \"usage\": xxxxx,                 (numeric) Estimated bytes used by the entries and the map holding them\n"
+            "    \"accumulatorcheckpoints\": xxxxx (numeric) Distinct accumulator checkpoints shared by the entries\n"
+            "  },\n"
+            "  \"recvbufferpool\": {               (json object) Payload buffers kept for reuse by received messages\n"
+            "    \"buffers\": xxxxx,               (numeric) Number of free buffers\n"
+            "    \"usage\": xxxxx                  (numeric) Bytes reserved by the free buffers\n"
+            "  }\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmemoryinfo", "") + HelpExampleRpc("getmemoryinfo", ""));
+
+    LOCK(cs_main);
+
+    UniValue blockindex(UniValue::VOBJ);
+    blockindex.push_back(Pair("entries", (uint64_t)mapBlockIndex.size()));
+    blockindex.push_back(Pair("entrysize", (uint64_t)sizeof(CBlockIndex)));
+    blockindex.push_back(Pair("usage", (uint64_t)GetBlockIndexUsage()));
+    blockindex.push_back(Pair("accumulatorcheckpoints", (uint64_t)CInternedHash::GetPoolSize()));
+
+    UniValue recvbufferpool(UniValue::VOBJ);
+    recvbufferpool.push_back(Pair("buffers", (uint64_t)recvBufferPool.GetFreeCount()));
+    recvbufferpool.push_back(Pair("usage", (uint64_t)recvBufferPool.GetFreeBytes()));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("blockindex", blockindex));
+    obj.push_back(Pair("recvbufferpool", recvbufferpool));
+    return obj;
+}
+
 #ifdef ENABLE_WALLET
 UniValue getstakingstatus(const UniValue& params, bool fHelp)
 {
@@ -562,6 +605,12 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"stakemodifiercache\": {           (json object) Stake modifier cache\n"
+            "    \"size\": xxxxx,                  (numeric) Number of cached stake modifiers\n"
+            "    \"hits\": xxxxx,                  (numeric) Lookups answered from the cache\n"
+            "    \"misses\": xxxxx,                (numeric) Lookups that walked the chain\n"
+            "    \"hitrate\": x.xxx                (numeric) Share of lookups answered from the cache\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -590,6 +639,14 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
 
+    StakeModifierCacheStats stats = GetStakeModifierCacheStats();
+    UniValue modifierCache(UniValue::VOBJ);
+    modifierCache.push_back(Pair("size", (int64_t) stats.nSize));
+    modifierCache.push_back(Pair("hits", (int64_t) stats.nHits));
+    modifierCache.push_back(Pair("misses", (int64_t) stats.nMisses));
+    modifierCache.push_back(Pair("hitrate", stats.nHits + stats.nMisses ? (double) stats.nHits / (stats.nHits + stats.nMisses) : 0.0));
+    obj.push_back(Pair("stakemodifiercache", modifierCache));
+
     return obj;
 }
 #endif // ENABLE_WALLET
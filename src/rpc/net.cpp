@@ -96,6 +96,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"sendrate\": n,             (numeric) The bytes sent per second over the last few seconds\n"
+            "    \"recvrate\": n,             (numeric) The bytes received per second over the last few seconds\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"timeoffset\": ttt,         (numeric) The time offset in seconds\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
@@ -110,7 +112,12 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"bytessent_per_msg\": {\n"
+            "       \"cmd\": n,               (numeric) The total bytes queued for the peer in messages of this type\n"
+            "       ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -138,6 +145,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("sendrate", stats.dSendRate));
+        obj.push_back(Pair("recvrate", stats.dRecvRate));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("timeoffset", stats.nTimeOffset));
         obj.push_back(Pair("pingtime", stats.dPingTime));
@@ -162,6 +171,13 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
+        UniValue sendPerMsgCmd(UniValue::VOBJ);
+        BOOST_FOREACH (const mapMsgCmdSize::value_type& i, stats.mapSendBytesPerMsgCmd) {
+            if (i.second > 0)
+                sendPerMsgCmd.push_back(Pair(i.first, i.second));
+        }
+        obj.push_back(Pair("bytessent_per_msg", sendPerMsgCmd));
+
         ret.push_back(obj);
     }
 
@@ -369,6 +385,59 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getmessagestats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getmessagestats\n"
+            "\nReturns how long processing the received messages took, by command.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {            (json object) The message command, \"other\" once too many commands were seen\n"
+            "    \"lane\": \"xxxx\",        (string) Processed by the \"main\" message handler or the message \"worker\"s\n"
+            "    \"count\": n,             (numeric) Number of messages processed\n"
+            "    \"totaltime\": n,         (numeric) Total processing time in microseconds\n"
+            "    \"avgtime\": n,           (numeric) Average processing time in microseconds\n"
+            "    \"maxtime\": n,           (numeric) Longest processing time in microseconds\n"
+            "    \"histogram\": {          (json object) Number of messages by processing time, empty buckets are omitted\n"
+            "      \"<n\": n,              (numeric) Messages that took less than n microseconds (and at least the previous bound)\n"
+            "      ...\n"
+            "      \">=n\": n              (numeric) Messages that took n microseconds or longer\n"
+            "    }\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmessagestats", "") + HelpExampleRpc("getmessagestats", ""));
+
+    std::map<std::string, CMessageTimeHistogram> mapTimes = GetMessageTimes();
+
+    UniValue ret(UniValue::VOBJ);
+    for (std::map<std::string, CMessageTimeHistogram>::const_iterator it = mapTimes.begin(); it != mapTimes.end(); ++it) {
+        const CMessageTimeHistogram& histogram = it->second;
+        UniValue buckets(UniValue::VOBJ);
+        for (int i = 0; i < CMessageTimeHistogram::BUCKETS; i++) {
+            if (histogram.vBuckets[i] == 0)
+                continue;
+            if (i < CMessageTimeHistogram::BUCKETS - 1)
+                buckets.push_back(Pair(strprintf("<%d", (int64_t)1 << i), histogram.vBuckets[i]));
+            else
+                buckets.push_back(Pair(strprintf(">=%d", (int64_t)1 << (i - 1)), histogram.vBuckets[i]));
+        }
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("lane", histogram.fWorkerLane ? "worker" : "main"));
+        obj.push_back(Pair("count", histogram.nCount));
+        obj.push_back(Pair("totaltime", histogram.nTotalMicros));
+        obj.push_back(Pair("avgtime", histogram.nCount ? histogram.nTotalMicros / (int64_t)histogram.nCount : 0));
+        obj.push_back(Pair("maxtime", histogram.nMaxMicros));
+        obj.push_back(Pair("histogram", buckets));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
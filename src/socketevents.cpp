@@ -0,0 +1,214 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/dequant-config.h"
+#endif
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+#include "utiltime.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include <algorithm>
+
+CSocketEvents::CSocketEvents(bool fUseEpoll) : hEpoll(-1)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (fUseEpoll) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            LogPrintf("CSocketEvents : epoll_create1 failed (%s), falling back to select\n", NetworkErrorString(errno));
+    }
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (hEpoll != -1)
+        close(hEpoll);
+#endif
+}
+
+bool CSocketEvents::IsEpollSupported()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string CSocketEvents::GetBackendName() const
+{
+    return hEpoll != -1 ? "epoll" : "select";
+}
+
+bool CSocketEvents::CanWatch(SOCKET hSocket) const
+{
+    return hEpoll != -1 || IsSelectableSocket(hSocket);
+}
+
+void CSocketEvents::Watch(SOCKET hSocket, uint64_t nId, int nEvents)
+{
+    std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.find(nId);
+    if (it == mapSockets.end() || it->second.hSocket != hSocket) {
+        CWatchedSocket sock;
+        sock.hSocket = hSocket;
+        sock.nReady = 0;
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpoll != -1) {
+            // Registered once for everything; what the caller wants is filtered in Wait()
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = nId;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hSocket, &event) == -1 &&
+                (errno != EEXIST || epoll_ctl(hEpoll, EPOLL_CTL_MOD, hSocket, &event) == -1)) {
+                LogPrintf("CSocketEvents : epoll_ctl failed for socket %d: %s\n", (int)hSocket, NetworkErrorString(errno));
+                // let the caller find out what is wrong with the socket
+                sock.nReady = EVENT_ERROR;
+            }
+        }
+#endif
+        it = mapSockets.insert(it, std::make_pair(nId, sock));
+        it->second = sock;
+    }
+    it->second.nWanted = nEvents;
+    it->second.fWatched = true;
+}
+
+void CSocketEvents::Wait(int64_t nTimeoutMs, std::vector<std::pair<uint64_t, int> >& vReady)
+{
+    vReady.clear();
+
+    if (hEpoll != -1)
+        WaitEpoll(nTimeoutMs);
+    else
+        WaitSelect(nTimeoutMs);
+
+    std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.begin();
+    while (it != mapSockets.end()) {
+        CWatchedSocket& sock = it->second;
+        if (!sock.fWatched) {
+            // The socket was closed, which also removed it from the epoll set. Deleting it
+            // explicitly could hit a new socket that reused the descriptor.
+            mapSockets.erase(it++);
+            continue;
+        }
+        int nEvents = sock.nReady & (sock.nWanted | EVENT_ERROR);
+        if (nEvents)
+            vReady.push_back(std::make_pair(it->first, nEvents));
+        sock.fWatched = false;
+        ++it;
+    }
+}
+
+void CSocketEvents::Drained(uint64_t nId, int nEvents)
+{
+    std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.find(nId);
+    if (it == mapSockets.end())
+        return;
+    // a failed recv is what reports an error, so it is drained with the receive side
+    if (nEvents & EVENT_RECV)
+        nEvents |= EVENT_ERROR;
+    it->second.nReady &= ~nEvents;
+}
+
+void CSocketEvents::WaitSelect(int64_t nTimeoutMs)
+{
+    struct timeval timeout = MillisToTimeval(nTimeoutMs);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+        CWatchedSocket& sock = it->second;
+        sock.nReady = 0;
+        if (!sock.fWatched || !IsSelectableSocket(sock.hSocket))
+            continue;
+        FD_SET(sock.hSocket, &fdsetError);
+        if (sock.nWanted & EVENT_RECV)
+            FD_SET(sock.hSocket, &fdsetRecv);
+        if (sock.nWanted & EVENT_SEND)
+            FD_SET(sock.hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, sock.hSocket);
+        have_fds = true;
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            // let the receive path find the broken socket
+            for (std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it)
+                it->second.nReady = EVENT_RECV;
+        }
+        MilliSleep(nTimeoutMs);
+        return;
+    }
+
+    for (std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+        CWatchedSocket& sock = it->second;
+        if (!sock.fWatched || !IsSelectableSocket(sock.hSocket))
+            continue;
+        if (FD_ISSET(sock.hSocket, &fdsetRecv))
+            sock.nReady |= EVENT_RECV;
+        if (FD_ISSET(sock.hSocket, &fdsetSend))
+            sock.nReady |= EVENT_SEND;
+        if (FD_ISSET(sock.hSocket, &fdsetError))
+            sock.nReady |= EVENT_ERROR;
+    }
+}
+
+void CSocketEvents::WaitEpoll(int64_t nTimeoutMs)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    // Don't sleep while a socket is still known to be ready for what the caller wants
+    for (std::map<uint64_t, CWatchedSocket>::const_iterator it = mapSockets.begin(); it != mapSockets.end(); ++it) {
+        const CWatchedSocket& sock = it->second;
+        if (sock.fWatched && (sock.nReady & (sock.nWanted | EVENT_ERROR))) {
+            nTimeoutMs = 0;
+            break;
+        }
+    }
+
+    std::vector<struct epoll_event> vEvents(std::max<size_t>(64, std::min<size_t>(mapSockets.size(), 1024)));
+    int nEvents = epoll_wait(hEpoll, &vEvents[0], vEvents.size(), nTimeoutMs);
+    if (nEvents == -1) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(nTimeoutMs);
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        std::map<uint64_t, CWatchedSocket>::iterator it = mapSockets.find(vEvents[i].data.u64);
+        if (it == mapSockets.end())
+            continue;
+        uint32_t events = vEvents[i].events;
+        if (events & (EPOLLIN | EPOLLRDHUP))
+            it->second.nReady |= EVENT_RECV;
+        if (events & EPOLLOUT)
+            it->second.nReady |= EVENT_SEND;
+        if (events & (EPOLLERR | EPOLLHUP))
+            it->second.nReady |= EVENT_ERROR;
+    }
+#endif
+}
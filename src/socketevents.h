@@ -0,0 +1,79 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Readiness notification for the sockets serviced by ThreadSocketHandler.
+ *
+ * The caller Watch()es every socket it wants to service on each iteration and then
+ * Wait()s for the ready ones. The epoll backend keeps sockets registered edge-triggered
+ * and remembers their readiness until the caller reports through Drained() that a recv
+ * or send came up short. The select backend rebuilds its fd_sets on every Wait() and is
+ * limited to sockets below FD_SETSIZE.
+ */
+class CSocketEvents
+{
+public:
+    enum {
+        EVENT_RECV = 1,
+        EVENT_SEND = 2,
+        EVENT_ERROR = 4,
+    };
+
+    /** Use epoll if requested and available, select otherwise */
+    explicit CSocketEvents(bool fUseEpoll = true);
+    ~CSocketEvents();
+
+    /** Whether this build has the epoll backend */
+    static bool IsEpollSupported();
+
+    /** Name of the backend in use, "epoll" or "select" */
+    std::string GetBackendName() const;
+
+    /** Whether the backend can service this socket at all */
+    bool CanWatch(SOCKET hSocket) const;
+
+    /** Service hSocket for nEvents on this iteration, nId identifies it in the results */
+    void Watch(SOCKET hSocket, uint64_t nId, int nEvents);
+
+    /**
+     * Wait up to nTimeoutMs until a watched socket is ready for one of its events.
+     * Errors are always reported. Sockets that were not watched since the previous
+     * Wait() are forgotten.
+     */
+    void Wait(int64_t nTimeoutMs, std::vector<std::pair<uint64_t, int> >& vReady);
+
+    /** A recv (EVENT_RECV) or send (EVENT_SEND) on nId did not complete, wait for the next edge */
+    void Drained(uint64_t nId, int nEvents);
+
+private:
+    struct CWatchedSocket {
+        SOCKET hSocket;
+        int nWanted;
+        int nReady;
+        bool fWatched;
+    };
+
+    std::map<uint64_t, CWatchedSocket> mapSockets;
+    // epoll instance, -1 when using select
+    int hEpoll;
+
+    void WaitSelect(int64_t nTimeoutMs);
+    void WaitEpoll(int64_t nTimeoutMs);
+
+    CSocketEvents(const CSocketEvents&);
+    void operator=(const CSocketEvents&);
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
@@ -81,7 +81,7 @@ bool CZDEQStake::GetModifier(uint64_t& nStakeModifier)
     int64_t nTimeBlockFrom = pindex->GetBlockTime();
     while (true) {
         if (pindex->GetBlockTime() - nTimeBlockFrom > 60*60) {
-            nStakeModifier = pindex->nAccumulatorCheckpoint.Get64();
+            nStakeModifier = pindex->nAccumulatorCheckpoint.Get().Get64();
             return true;
         }
 
@@ -173,6 +173,13 @@ bool CDEQStake::SetInput(CTransaction txPrev, unsigned int n)
     return true;
 }
 
+void CDEQStake::SetIndexFrom(CBlockIndex* pindex, uint64_t nStakeModifier)
+{
+    this->pindexFrom = pindex;
+    this->nStakeModifierFrom = nStakeModifier;
+    this->fStakeModifierFrom = true;
+}
+
 bool CDEQStake::GetTxFrom(CTransaction& tx)
 {
     tx = txFrom;
@@ -227,6 +234,11 @@ bool CDEQStake::CreateTxOuts(CWallet* pwallet, vector<CTxOut>& vout, CAmount nTo
 
 bool CDEQStake::GetModifier(uint64_t& nStakeModifier)
 {
+    if (fStakeModifierFrom) {
+        nStakeModifier = nStakeModifierFrom;
+        return true;
+    }
+
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
     GetIndexFrom();
@@ -250,6 +262,9 @@ CDataStream CDEQStake::GetUniqueness()
 //The block that the UTXO was added to the chain
 CBlockIndex* CDEQStake::GetIndexFrom()
 {
+    if (pindexFrom)
+        return pindexFrom;
+
     uint256 hashBlock = 0;
     CTransaction tx;
     if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
@@ -69,13 +69,19 @@ class CDEQStake : public CStakeInput
 private:
     CTransaction txFrom;
     unsigned int nPosition;
+    uint64_t nStakeModifierFrom;
+    bool fStakeModifierFrom;
 public:
     CDEQStake()
     {
         this->pindexFrom = nullptr;
+        nStakeModifierFrom = 0;
+        fStakeModifierFrom = false;
     }
 
     bool SetInput(CTransaction txPrev, unsigned int n);
+    // Chain data the wallet already resolved, saves the transaction and modifier lookups
+    void SetIndexFrom(CBlockIndex* pindex, uint64_t nStakeModifier);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) override;
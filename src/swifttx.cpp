@@ -29,6 +29,7 @@ std::map<uint256, CTransactionLock> mapTxLocks;
 std::map<COutPoint, uint256> mapLockedInputs;
 std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
 int nCompleteTXLocks;
+CCriticalSection cs_swifttx;
 
 //txlock - Locks transaction
 //
@@ -43,6 +44,8 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
     if (!IsSporkActive(SPORK_2_SWIFTTX)) return;
     if (!masternodeSync.IsBlockchainSynced()) return;
 
+    LOCK(cs_swifttx);
+
     if (strCommand == "ix") {
         //LogPrintf("ProcessMessageSwiftTX::ix\n");
         CDataStream vMsg(vRecv);
@@ -435,6 +438,8 @@ void CleanTransactionLocksList()
 {
     if (chainActive.Tip() == NULL) return;
 
+    LOCK(cs_swifttx);
+
     std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
 
     while (it != mapTxLocks.end()) {
@@ -43,6 +43,8 @@ extern map<uint256, CConsensusVote> mapTxLockVote;
 extern map<uint256, CTransactionLock> mapTxLocks;
 extern std::map<COutPoint, uint256> mapLockedInputs;
 extern int nCompleteTXLocks;
+// Serializes the SwiftX message handling, which runs on the message workers, with the expiry of old locks
+extern CCriticalSection cs_swifttx;
 
 
 int64_t CreateNewLock(CTransaction tx);
@@ -20,6 +20,10 @@
 #include <exception>
 #include <cstdlib>
 #include <sys/time.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include "checkqueue.h"
+#include "main.h"
 #include "streams.h"
 #include "libzerocoin/ParamGeneration.h"
 #include "libzerocoin/Denominations.h"
@@ -35,6 +39,8 @@ using namespace libzerocoin;
 #define COLOR_STR_RED     "\033[31m"
 
 #define TESTS_COINS_TO_ACCUMULATE   50
+#define TESTS_SPENDS_PER_BLOCK      4
+#define TESTS_BLOCKS_TO_VERIFY      3
 
 // Global test counters
 uint32_t    ggNumTests        = 0;
@@ -370,6 +376,82 @@ Testb_MintAndSpend()
 	return false;
 }
 
+bool
+Testb_ParallelSpendVerify()
+{
+	try {
+		if (ggCoins[0] == NULL) {
+			Testb_MintCoin();
+			if (ggCoins[0] == NULL) {
+				return false;
+			}
+		}
+
+		Accumulator acc(&gg_Params->accumulatorParams,CoinDenomination::ZQ_ONE);
+		for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+			acc += ggCoins[i]->getPublicCoin();
+		}
+
+		// Build one block worth of spends, each with its own witness
+		vector<CoinSpend> vSpends;
+		for (uint32_t i = 0; i < TESTS_SPENDS_PER_BLOCK; i++) {
+			Accumulator accEmpty(&gg_Params->accumulatorParams,CoinDenomination::ZQ_ONE);
+			AccumulatorWitness witness(gg_Params, accEmpty, ggCoins[i]->getPublicCoin());
+			for (uint32_t j = 0; j < TESTS_COINS_TO_ACCUMULATE; j++) {
+				witness += ggCoins[j]->getPublicCoin();
+			}
+			vSpends.push_back(CoinSpend(gg_Params, gg_Params, *(ggCoins[i]), acc, 0, witness, 0, SpendType::SPEND));
+		}
+
+		// Serial verification, as ConnectBlock did before the check queue
+		bool fSerialOk = true;
+		timer.start();
+		for (uint32_t n = 0; n < TESTS_BLOCKS_TO_VERIFY; n++) {
+			for (const CoinSpend& spend : vSpends) {
+				fSerialOk &= CZerocoinSpendCheck(spend, gg_Params, acc.getValue(), 0, false)();
+			}
+		}
+		timer.stop();
+		int nSerialMs = std::max(1, timer.duration());
+
+		// Parallel verification through a check queue with one worker per core
+		CCheckQueue<CZerocoinSpendCheck> queue(16);
+		boost::thread_group threads;
+		int nThreads = std::max(2, (int)boost::thread::hardware_concurrency());
+		for (int i = 0; i < nThreads - 1; i++) {
+			threads.create_thread(boost::bind(&CCheckQueue<CZerocoinSpendCheck>::Thread, &queue));
+		}
+
+		bool fParallelOk = true;
+		timer.start();
+		for (uint32_t n = 0; n < TESTS_BLOCKS_TO_VERIFY; n++) {
+			vector<CZerocoinSpendCheck> vChecks;
+			for (const CoinSpend& spend : vSpends) {
+				vChecks.push_back(CZerocoinSpendCheck(spend, gg_Params, acc.getValue(), 0, false));
+			}
+			CCheckQueueControl<CZerocoinSpendCheck> control(&queue);
+			control.Add(vChecks);
+			fParallelOk &= control.Wait();
+		}
+		timer.stop();
+		int nParallelMs = std::max(1, timer.duration());
+
+		threads.interrupt_all();
+		threads.join_all();
+
+		cout << "\tBLOCK VERIFY (" << TESTS_SPENDS_PER_BLOCK << " spends/block):\n\t\tSerial: " << nSerialMs / TESTS_BLOCKS_TO_VERIFY << " ms/block\t"
+			 << 1000.0 * TESTS_BLOCKS_TO_VERIFY / nSerialMs << " blocks/s\n\t\tParallel (" << nThreads << " threads): "
+			 << nParallelMs / TESTS_BLOCKS_TO_VERIFY << " ms/block\t" << 1000.0 * TESTS_BLOCKS_TO_VERIFY / nParallelMs << " blocks/s" << endl;
+
+		return fSerialOk && fParallelOk;
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return false;
+}
+
 void
 Testb_RunAllTests()
 {
@@ -389,6 +471,7 @@ Testb_RunAllTests()
 	gLogTestResult("coins can be minted", Testb_MintCoin);
 	gLogTestResult("the accumulator works", Testb_Accumulator);
 	gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
+	gLogTestResult("a block of spends verifies in parallel", Testb_ParallelSpendVerify);
 
 	// Summarize test results
 	if (ggSuccessfulTests < ggNumTests) {
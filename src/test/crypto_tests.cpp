@@ -9,8 +9,11 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
+#include "tinyformat.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 
 #include <vector>
 
@@ -131,6 +134,44 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j)
+            in[j] = insecure_rand();
+        for (int j = 0; j < i; ++j)
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64_benchmark)
+{
+    // A merkle level of 4096 pairs, hashed one by one and then through the batched API
+    std::vector<unsigned char> in(64 * 4096), out1(32 * 4096), out2(32 * 4096);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = insecure_rand();
+
+    int64_t nStart = GetTimeMicros();
+    for (int r = 0; r < 10; r++) {
+        for (int i = 0; i < 4096; i++)
+            CHash256().Write(&in[64 * i], 64).Finalize(&out1[32 * i]);
+    }
+    int64_t nSingle = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int r = 0; r < 10; r++)
+        SHA256D64(&out2[0], &in[0], 4096);
+    int64_t nBatched = GetTimeMicros() - nStart;
+
+    BOOST_CHECK(out1 == out2);
+    BOOST_TEST_MESSAGE(strprintf("SHA256D64: %.1fns per hash one by one, %.1fns batched",
+        nSingle * 1000.0 / 40960, nBatched * 1000.0 / 40960));
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
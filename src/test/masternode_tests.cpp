@@ -0,0 +1,142 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "masternode-payments.h"
+#include "masternodeman.h"
+#include "script/standard.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(masternode_tests)
+
+static CScript GetPayeeScript(int n)
+{
+    return GetScriptForDestination(CKeyID(uint160(n)));
+}
+
+// The chain walk CMasternode::GetLastPaid did before the last-paid index
+static int WalkLastPaidHeight(CMasternodePayments& payments, const CScript& payee, int nHeight, int nDepth)
+{
+    for (int n = 0; nHeight > 0 && n < nDepth; n++, nHeight--) {
+        if (payments.mapMasternodeBlocks.count(nHeight) && payments.mapMasternodeBlocks[nHeight].HasPayeeWithVotes(payee, 2))
+            return nHeight;
+    }
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(last_paid_index)
+{
+    CMasternodePayments payments;
+    for (int nHeight = 1; nHeight <= 40; nHeight++) {
+        CMasternodeBlockPayees& block = payments.mapMasternodeBlocks[nHeight];
+        block.nBlockHeight = nHeight;
+        block.AddPayee(GetPayeeScript(nHeight % 7), 1, 6);
+        // A single vote is not a payment
+        block.AddPayee(GetPayeeScript(100 + nHeight % 3), 1, 1);
+    }
+    payments.RebuildLastPaidIndex();
+
+    for (int n = 0; n < 7; n++) {
+        for (int nHeight = 0; nHeight <= 45; nHeight += 3) {
+            for (int nDepth = 0; nDepth <= 12; nDepth += 4) {
+                BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(GetPayeeScript(n), nHeight, nDepth),
+                    WalkLastPaidHeight(payments, GetPayeeScript(n), nHeight, nDepth));
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(GetPayeeScript(101), 40, 40), 0);
+    BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(GetPayeeScript(3), 30, 100), 24);
+
+    // The index is rebuilt when the payments are loaded from mnpayments.dat
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << payments;
+    CMasternodePayments payments2;
+    ss >> payments2;
+    BOOST_CHECK_EQUAL(payments2.GetLastPaidHeight(GetPayeeScript(3), 30, 100), 24);
+
+    payments2.Clear();
+    BOOST_CHECK_EQUAL(payments2.GetLastPaidHeight(GetPayeeScript(3), 30, 100), 0);
+}
+
+BOOST_AUTO_TEST_CASE(last_paid_benchmark)
+{
+    // 10k masternodes each paid once per cycle; ordering the payment queue looks up every one of them
+    const int nMasternodes = 10000;
+    const int nDepth = nMasternodes * 1.25;
+    const int nTip = 2 * nMasternodes;
+
+    CMasternodePayments payments;
+    std::vector<CScript> vPayees;
+    for (int n = 0; n < nMasternodes; n++)
+        vPayees.push_back(GetPayeeScript(n));
+    for (int nHeight = 1; nHeight <= nTip; nHeight++) {
+        CMasternodeBlockPayees& block = payments.mapMasternodeBlocks[nHeight];
+        block.nBlockHeight = nHeight;
+        block.AddPayee(vPayees[nHeight % nMasternodes], 1, 6);
+    }
+    payments.RebuildLastPaidIndex();
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<std::pair<int, int> > vecLastPaid;
+    for (int n = 0; n < nMasternodes; n++)
+        vecLastPaid.push_back(std::make_pair(payments.GetLastPaidHeight(vPayees[n], nTip, nDepth), n));
+    std::sort(vecLastPaid.begin(), vecLastPaid.end());
+    BOOST_TEST_MESSAGE(strprintf("ordered %d masternodes by last payment in %.2fms", nMasternodes, 0.001 * (GetTimeMicros() - nStart)));
+
+    // Masternode 1 was paid at nMasternodes + 1 and is the oldest
+    BOOST_CHECK_EQUAL(vecLastPaid.front().second, 1);
+    BOOST_CHECK_EQUAL(vecLastPaid.front().first, nMasternodes + 1);
+    BOOST_CHECK_EQUAL(vecLastPaid.back().first, nTip);
+    for (int n = 0; n < nMasternodes; n += 997)
+        BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(vPayees[n], nTip, nDepth), WalkLastPaidHeight(payments, vPayees[n], nTip, nDepth));
+}
+
+static CMasternode GetTestMasternode(int n)
+{
+    CMasternode mn;
+    mn.vin = CTxIn(COutPoint(uint256(n), n % 2));
+    std::vector<unsigned char> vchPubKey(33, (unsigned char)n);
+    vchPubKey[0] = 0x02;
+    mn.pubKeyMasternode = CPubKey(vchPubKey.begin(), vchPubKey.end());
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(masternode_indexes)
+{
+    CMasternodeMan manager;
+    for (int n = 1; n <= 20; n++) {
+        CMasternode mn = GetTestMasternode(n);
+        BOOST_CHECK(manager.Add(mn));
+    }
+    CMasternode mnDuplicate = GetTestMasternode(5);
+    BOOST_CHECK(!manager.Add(mnDuplicate));
+    BOOST_CHECK_EQUAL(manager.size(), 20);
+
+    manager.Remove(GetTestMasternode(7).vin);
+    BOOST_CHECK(manager.Find(GetTestMasternode(7).vin) == NULL);
+    BOOST_CHECK(manager.Find(GetTestMasternode(7).pubKeyMasternode) == NULL);
+
+    CMasternode mnNew = GetTestMasternode(21);
+    BOOST_CHECK(manager.Add(mnNew));
+
+    for (int n = 1; n <= 21; n++) {
+        if (n == 7) continue;
+        CMasternode mn = GetTestMasternode(n);
+        CMasternode* pmn = manager.Find(mn.vin);
+        BOOST_CHECK(pmn != NULL && pmn->vin == mn.vin);
+        BOOST_CHECK(manager.Find(mn.pubKeyMasternode) == pmn);
+    }
+
+    // the snapshot is a copy, later changes to the list don't show up in it
+    boost::shared_ptr<const std::vector<CMasternode> > pSnapshot = manager.GetSnapshot();
+    BOOST_CHECK_EQUAL(pSnapshot->size(), 20U);
+    manager.Clear();
+    BOOST_CHECK_EQUAL(pSnapshot->size(), 20U);
+    BOOST_CHECK(manager.GetSnapshot()->empty());
+    BOOST_CHECK(manager.Find(GetTestMasternode(1).vin) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
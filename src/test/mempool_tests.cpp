@@ -6,6 +6,7 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 #include <list>
 
@@ -99,4 +100,142 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+static CMutableTransaction MakeSpend(const uint256& hashPrev, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = nValue;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorDescendantTest)
+{
+    // A chain of three transactions: txA <- txB <- txC
+    CMutableTransaction txA = MakeSpend(uint256(1), 10 * COIN);
+    CMutableTransaction txB = MakeSpend(txA.GetHash(), 9 * COIN);
+    CMutableTransaction txC = MakeSpend(txB.GetHash(), 8 * COIN);
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.setSanityCheck(false);
+    pool.addUnchecked(txA.GetHash(), CTxMemPoolEntry(txA, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txB.GetHash(), CTxMemPoolEntry(txB, 2000, 0, 0.0, 1));
+    pool.addUnchecked(txC.GetHash(), CTxMemPoolEntry(txC, 3000, 0, 0.0, 1));
+
+    CTxMemPool::txiter itA = pool.mapTx.find(txA.GetHash());
+    CTxMemPool::txiter itB = pool.mapTx.find(txB.GetHash());
+    CTxMemPool::txiter itC = pool.mapTx.find(txC.GetHash());
+    uint64_t nSize = itA->GetTxSize();
+
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(itA->GetSizeWithDescendants(), 3 * nSize);
+    BOOST_CHECK_EQUAL(itA->GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(itB->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(itC->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(itC->GetModFeesWithAncestors(), 6000);
+
+    // Prioritising a transaction shows up in the totals of its whole family
+    pool.PrioritiseTransaction(txC.GetHash(), txC.GetHash().ToString(), 0, 500);
+    BOOST_CHECK_EQUAL(itA->GetModFeesWithDescendants(), 6500);
+    BOOST_CHECK_EQUAL(itC->GetModFeesWithAncestors(), 6500);
+    pool.PrioritiseTransaction(txA.GetHash(), txA.GetHash().ToString(), 0, 500);
+    BOOST_CHECK_EQUAL(itC->GetModFeesWithAncestors(), 7000);
+
+    // The ancestor limits are enforced
+    CMutableTransaction txD = MakeSpend(txC.GetHash(), 7 * COIN);
+    CTxMemPoolEntry entryD(txD, 4000, 0, 0.0, 1);
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryD, setAncestors, 3, 1000000, 25, 1000000, errString));
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryD, setAncestors, 4, 1000000, 25, 1000000, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+
+    // Removing the root, as a block would, leaves the rest with fewer ancestors
+    std::list<CTransaction> removed;
+    pool.remove(txA, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(itB->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(itC->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(itC->GetModFeesWithAncestors(), 5500);
+
+    // Putting it back, as a reorg would, links it to the children already in the pool
+    pool.addUnchecked(txA.GetHash(), CTxMemPoolEntry(txA, 1000, 0, 0.0, 1));
+    itA = pool.mapTx.find(txA.GetHash());
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(itA->GetModFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(itB->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(itC->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(itC->GetModFeesWithAncestors(), 7000);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(itA).size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction txCheap = MakeSpend(uint256(1), 10 * COIN);
+    CMutableTransaction txCheapChild = MakeSpend(txCheap.GetHash(), 9 * COIN);
+    CMutableTransaction txDear = MakeSpend(uint256(2), 10 * COIN);
+
+    pool.addUnchecked(txCheap.GetHash(), CTxMemPoolEntry(txCheap, 100, 10, 0.0, 1));
+    pool.addUnchecked(txCheapChild.GetHash(), CTxMemPoolEntry(txCheapChild, 200, 20, 0.0, 1));
+    pool.addUnchecked(txDear.GetHash(), CTxMemPoolEntry(txDear, 100000, 30, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // Trimming evicts the cheapest package, parent and child together
+    std::list<CTransaction> removed;
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK(pool.exists(txDear.GetHash()));
+    BOOST_CHECK(!pool.exists(txCheap.GetHash()));
+    BOOST_CHECK(!pool.exists(txCheapChild.GetHash()));
+
+    // ... and raises the minimum fee above what the package paid
+    uint64_t nPackageSize = 2 * ::GetSerializeSize(txCheap, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(pool.GetMinFee(1) > CFeeRate(300, nPackageSize));
+
+    // Expiry removes transactions that entered the pool before the given time
+    pool.addUnchecked(txCheap.GetHash(), CTxMemPoolEntry(txCheap, 100, 10, 0.0, 1));
+    removed.clear();
+    BOOST_CHECK_EQUAL(pool.Expire(20, removed), 1);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK(!pool.exists(txCheap.GetHash()));
+    BOOST_CHECK_EQUAL(pool.Expire(20, removed), 0);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+}
+
+static void CountEntry(int* pnCount, const CTransaction& tx)
+{
+    (*pnCount)++;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolNotifyTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    int nAdded = 0;
+    int nRemoved = 0;
+    pool.NotifyEntryAdded.connect(boost::bind(&CountEntry, &nAdded, boost::placeholders::_1));
+    pool.NotifyEntryRemoved.connect(boost::bind(&CountEntry, &nRemoved, boost::placeholders::_1));
+
+    CMutableTransaction txA = MakeSpend(uint256(1), 10 * COIN);
+    CMutableTransaction txB = MakeSpend(txA.GetHash(), 9 * COIN);
+    CMutableTransaction txC = MakeSpend(uint256(2), 10 * COIN);
+    pool.addUnchecked(txA.GetHash(), CTxMemPoolEntry(txA, 0, 0, 0.0, 1));
+    pool.addUnchecked(txB.GetHash(), CTxMemPoolEntry(txB, 0, 0, 0.0, 1));
+    pool.addUnchecked(txC.GetHash(), CTxMemPoolEntry(txC, 0, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(nAdded, 3);
+
+    // Every transaction leaving the pool is reported, descendants included
+    std::list<CTransaction> removed;
+    pool.remove(txA, removed, true);
+    BOOST_CHECK_EQUAL(nRemoved, 2);
+    pool.clear();
+    BOOST_CHECK_EQUAL(nRemoved, 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
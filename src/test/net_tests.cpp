@@ -0,0 +1,191 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "net.h"
+#include "netbase.h"
+#include "timedata.h"
+#include "version.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+// Feed a message carrying vAddr to the receive buffer of node, as the socket handler would
+static void ReceiveAddrMessage(CNode& node, const std::string& strCommand, const std::vector<CAddress>& vAddr)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << vAddr;
+    CMessageHeader hdr(strCommand.c_str(), ssPayload.size());
+    hdr.nChecksum = GetMessageChecksum(ssPayload.begin(), ssPayload.end());
+    CDataStream ssMessage(SER_NETWORK, PROTOCOL_VERSION);
+    ssMessage << hdr;
+    ssMessage.write(&ssPayload[0], ssPayload.size());
+
+    LOCK(node.cs_vRecvMsg);
+    BOOST_REQUIRE(node.ReceiveMsgBytes(&ssMessage[0], ssMessage.size()));
+}
+
+static std::vector<CAddress> MakeAddr(const std::string& strAddr)
+{
+    CAddress addr(CService(strAddr, Params().GetDefaultPort()));
+    addr.nTime = GetAdjustedTime();
+    return std::vector<CAddress>(1, addr);
+}
+
+BOOST_AUTO_TEST_CASE(message_time_histogram)
+{
+    BOOST_CHECK_EQUAL(CMessageTimeHistogram::GetBucket(0), 0);
+    BOOST_CHECK_EQUAL(CMessageTimeHistogram::GetBucket(1), 1);
+    BOOST_CHECK_EQUAL(CMessageTimeHistogram::GetBucket(2), 2);
+    BOOST_CHECK_EQUAL(CMessageTimeHistogram::GetBucket(3), 2);
+    BOOST_CHECK_EQUAL(CMessageTimeHistogram::GetBucket(1000), 10);
+    BOOST_CHECK_EQUAL(CMessageTimeHistogram::GetBucket(std::numeric_limits<int64_t>::max()), CMessageTimeHistogram::BUCKETS - 1);
+
+    CMessageTimeHistogram histogram;
+    histogram.Add(3);
+    histogram.Add(1000);
+    histogram.Add(1001);
+    BOOST_CHECK_EQUAL(histogram.nCount, 3U);
+    BOOST_CHECK_EQUAL(histogram.nTotalMicros, 2004);
+    BOOST_CHECK_EQUAL(histogram.nMaxMicros, 1001);
+    BOOST_CHECK_EQUAL(histogram.vBuckets[2], 1U);
+    BOOST_CHECK_EQUAL(histogram.vBuckets[10], 2U);
+
+    RecordMessageTime("net_tests", 5, true);
+    std::map<std::string, CMessageTimeHistogram> mapTimes = GetMessageTimes();
+    BOOST_CHECK(mapTimes.count("net_tests"));
+    BOOST_CHECK(mapTimes["net_tests"].fWorkerLane);
+    BOOST_CHECK_EQUAL(mapTimes["net_tests"].vBuckets[3], 1U);
+}
+
+BOOST_AUTO_TEST_CASE(worker_lane_order)
+{
+    int nMessageWorkersSaved = nMessageWorkers;
+    nMessageWorkers = 1;
+
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    node.nVersion = PROTOCOL_VERSION;
+    node.nRecvVersion = PROTOCOL_VERSION;
+    node.fSuccessfullyConnected = true;
+
+    ReceiveAddrMessage(node, "addr", MakeAddr("1.2.3.4"));
+    ReceiveAddrMessage(node, "addr", MakeAddr("1.2.3.5"));
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(ProcessMessages(&node));
+        BOOST_CHECK(node.vRecvMsg.empty());
+    }
+
+    // both went to the worker lane, in the order they were received
+    BOOST_REQUIRE_EQUAL(node.vRecvMsgWorker.size(), 2U);
+    std::vector<CAddress> vAddr;
+    CDataStream ssFirst = node.vRecvMsgWorker.front().vRecv;
+    ssFirst >> vAddr;
+    BOOST_CHECK_EQUAL(vAddr[0].ToStringIP(), "1.2.3.4");
+
+    ProcessWorkerMessages(&node);
+    BOOST_CHECK_EQUAL(node.vRecvMsgWorker.size(), 1U);
+    BOOST_CHECK(node.setAddrKnown.count(MakeAddr("1.2.3.4")[0]));
+    BOOST_CHECK(!node.setAddrKnown.count(MakeAddr("1.2.3.5")[0]));
+
+    // a worker doesn't take a node another worker is busy with
+    node.fRecvMsgWorkerBusy = true;
+    ProcessWorkerMessages(&node);
+    BOOST_CHECK_EQUAL(node.vRecvMsgWorker.size(), 1U);
+    node.fRecvMsgWorkerBusy = false;
+
+    ProcessWorkerMessages(&node);
+    BOOST_CHECK(node.vRecvMsgWorker.empty());
+    BOOST_CHECK_EQUAL(node.nRecvMsgWorkerSize, 0U);
+    BOOST_CHECK(node.setAddrKnown.count(MakeAddr("1.2.3.5")[0]));
+
+    // while the worker lane is backed up, messages stay subject to receive flood control
+    node.nRecvMsgWorkerSize = ReceiveFloodSize();
+    ReceiveAddrMessage(node, "addr", MakeAddr("1.2.3.6"));
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(ProcessMessages(&node));
+        BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 1U);
+    }
+    BOOST_CHECK(node.vRecvMsgWorker.empty());
+
+    nMessageWorkers = nMessageWorkersSaved;
+}
+
+BOOST_AUTO_TEST_CASE(receive_split_message)
+{
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    node.nRecvVersion = PROTOCOL_VERSION;
+
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    for (int i = 0; i < 10000; i++)
+        ssPayload << i;
+    CMessageHeader hdr("block", ssPayload.size());
+    hdr.nChecksum = GetMessageChecksum(ssPayload.begin(), ssPayload.end());
+    CDataStream ssMessage(SER_NETWORK, PROTOCOL_VERSION);
+    ssMessage << hdr;
+    ssMessage.write(&ssPayload[0], ssPayload.size());
+
+    // feed it in uneven pieces, some of them splitting the header
+    LOCK(node.cs_vRecvMsg);
+    unsigned int nPos = 0;
+    for (unsigned int nPiece = 1; nPos < ssMessage.size(); nPiece = nPiece * 3 + 1) {
+        unsigned int nBytes = std::min(nPiece, (unsigned int)ssMessage.size() - nPos);
+        BOOST_REQUIRE(node.ReceiveMsgBytes(&ssMessage[nPos], nBytes));
+        nPos += nBytes;
+    }
+
+    BOOST_REQUIRE_EQUAL(node.vRecvMsg.size(), 1U);
+    CNetMessage& msg = node.vRecvMsg.front();
+    BOOST_REQUIRE(msg.complete());
+    BOOST_CHECK(msg.GetMessageHash() == Hash(ssPayload.begin(), ssPayload.end()));
+    BOOST_CHECK(msg.vRecv.str() == ssPayload.str());
+    BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "block");
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CNetMessageBufferPool pool;
+
+    CSerializeData data;
+    pool.Get(data, 1000);
+    BOOST_CHECK(data.empty());
+    BOOST_CHECK(data.capacity() >= 1000);
+    data.resize(1000);
+    const char* pchBuffer = &data[0];
+    pool.Put(data);
+    BOOST_CHECK(data.empty());
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 1U);
+
+    // a smaller request reuses the buffer, a bigger one gets a new one
+    CSerializeData data2;
+    pool.Get(data2, 5000);
+    BOOST_CHECK(data2.capacity() >= 5000);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 1U);
+    pool.Get(data, 500);
+    BOOST_CHECK(data.empty());
+    data.resize(1);
+    BOOST_CHECK(&data[0] == pchBuffer);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 0U);
+
+    // the smallest buffer that fits is taken
+    pool.Put(data2);
+    pool.Put(data);
+    pool.Get(data, 800);
+    data.resize(1);
+    BOOST_CHECK(&data[0] == pchBuffer);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 1U);
+
+    // the pool doesn't grow beyond its byte limit
+    CSerializeData dataHuge;
+    dataHuge.reserve(MAX_POOLED_RECV_BYTES);
+    pool.Put(dataHuge);
+    BOOST_CHECK_EQUAL(pool.GetFreeCount(), 1U);
+    BOOST_CHECK(pool.GetFreeBytes() < MAX_POOLED_RECV_BYTES);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
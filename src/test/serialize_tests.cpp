@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain.h"
 #include "serialize.h"
 #include "streams.h"
 
@@ -161,4 +162,87 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    uint32_t a = 0x01020304;
+    std::string str = "span";
+    ss << a << str << VARINT(300);
+
+    std::vector<char> vch(ss.begin(), ss.end());
+    CSpanReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, 0);
+    BOOST_CHECK_EQUAL(reader.size(), vch.size());
+
+    uint32_t a2 = 0;
+    std::string str2;
+    int n = 0;
+    reader >> a2 >> str2 >> VARINT(n);
+    BOOST_CHECK_EQUAL(a2, a);
+    BOOST_CHECK_EQUAL(str2, str);
+    BOOST_CHECK_EQUAL(n, 300);
+    BOOST_CHECK(reader.empty());
+
+    // Reading past the end of the span throws, as with the other streams
+    CSpanReader truncated(&vch[0], &vch[0] + 2, SER_DISK, 0);
+    BOOST_CHECK_THROW(truncated >> a2, std::ios_base::failure);
+    CSpanReader skip(&vch[0], &vch[0] + vch.size(), SER_DISK, 0);
+    skip.ignore(sizeof(a));
+    skip >> str2;
+    BOOST_CHECK_EQUAL(str2, str);
+    BOOST_CHECK_THROW(skip.ignore(vch.size()), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_denominations)
+{
+    // The block index keeps the zerocoin supply and mints in fixed arrays but stores them
+    // as the map and list it used before
+    std::map<libzerocoin::CoinDenomination, int64_t> mapSupply;
+    for (libzerocoin::CoinDenomination denom : libzerocoin::zerocoinDenomList)
+        mapSupply.insert(std::make_pair(denom, 0));
+    mapSupply[libzerocoin::ZQ_FIVE] = 7;
+    mapSupply[libzerocoin::ZQ_FIVE_THOUSAND] = -1;
+    std::vector<libzerocoin::CoinDenomination> vMints;
+    vMints.push_back(libzerocoin::ZQ_TEN);
+    vMints.push_back(libzerocoin::ZQ_TEN);
+    vMints.push_back(libzerocoin::ZQ_ONE_HUNDRED);
+
+    CZerocoinSupply supply;
+    supply.at(libzerocoin::ZQ_FIVE) = 7;
+    supply.at(libzerocoin::ZQ_FIVE_THOUSAND) = -1;
+    CMintDenominations mints;
+    mints.Add(libzerocoin::ZQ_TEN);
+    mints.Add(libzerocoin::ZQ_ONE_HUNDRED);
+    mints.Add(libzerocoin::ZQ_TEN);
+    BOOST_CHECK_EQUAL(mints.Count(libzerocoin::ZQ_TEN), 2);
+    BOOST_CHECK_EQUAL(mints.Count(libzerocoin::ZQ_ONE), 0);
+    BOOST_CHECK_THROW(supply.at(libzerocoin::ZQ_ERROR), std::out_of_range);
+
+    CDataStream ssOld(SER_DISK, 0);
+    ssOld << mapSupply << vMints;
+    CDataStream ssNew(SER_DISK, 0);
+    ssNew << supply << mints;
+    BOOST_CHECK(ssOld.str() == ssNew.str());
+
+    CZerocoinSupply supply2;
+    CMintDenominations mints2;
+    ssOld >> supply2 >> mints2;
+    BOOST_CHECK_EQUAL(supply2.at(libzerocoin::ZQ_FIVE), 7);
+    BOOST_CHECK_EQUAL(supply2.at(libzerocoin::ZQ_FIVE_THOUSAND), -1);
+    BOOST_CHECK_EQUAL(supply2.at(libzerocoin::ZQ_ONE), 0);
+    BOOST_CHECK_EQUAL(mints2.Count(libzerocoin::ZQ_TEN), 2);
+    BOOST_CHECK_EQUAL(mints2.Count(libzerocoin::ZQ_ONE_HUNDRED), 1);
+
+    // Equal checkpoints share storage
+    uint256 hash = 12345;
+    CInternedHash a(hash), b(hash), zero;
+    BOOST_CHECK(a == b && a == hash && hash == b);
+    BOOST_CHECK(zero != a && zero == 0);
+    CDataStream ssHash(SER_DISK, 0);
+    ssHash << a;
+    BOOST_CHECK_EQUAL(ssHash.size(), 32U);
+    CInternedHash c;
+    ssHash >> c;
+    BOOST_CHECK(c == a);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
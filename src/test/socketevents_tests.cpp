@@ -0,0 +1,159 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "tinyformat.h"
+#include "utiltime.h"
+
+#include <map>
+#include <string.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(socketevents_tests)
+
+static const uint64_t LISTEN_ID = 0;
+
+// Listen on an ephemeral loopback port
+static SOCKET ListenLoopback(struct sockaddr_in& addr)
+{
+    SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hListen != INVALID_SOCKET);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&addr, len) == 0);
+    BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&addr, &len) == 0);
+    BOOST_REQUIRE(listen(hListen, SOMAXCONN) == 0);
+    BOOST_REQUIRE(SetSocketNonBlocking(hListen, true));
+    return hListen;
+}
+
+// Watch the listen socket and every accepted peer, then wait for them
+static std::map<uint64_t, int> WaitPeers(CSocketEvents& events, SOCKET hListen, const std::vector<SOCKET>& vPeers, int64_t nTimeout)
+{
+    events.Watch(hListen, LISTEN_ID, CSocketEvents::EVENT_RECV);
+    for (size_t i = 0; i < vPeers.size(); i++) {
+        if (vPeers[i] != INVALID_SOCKET)
+            events.Watch(vPeers[i], i + 1, CSocketEvents::EVENT_RECV);
+    }
+    std::vector<std::pair<uint64_t, int> > vReady;
+    events.Wait(nTimeout, vReady);
+    return std::map<uint64_t, int>(vReady.begin(), vReady.end());
+}
+
+// Open nPeers synthetic peers over loopback and have the server side service them through the events
+static void RunLoopbackPeers(bool fUseEpoll, int nPeers)
+{
+    CSocketEvents events(fUseEpoll);
+    struct sockaddr_in addr;
+    SOCKET hListen = ListenLoopback(addr);
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<SOCKET> vClients;
+    std::vector<SOCKET> vPeers;
+    while ((int)vPeers.size() < nPeers) {
+        // connect in batches that fit into any listen backlog
+        int nBatch = std::min(nPeers - (int)vClients.size(), 32);
+        for (int i = 0; i < nBatch; i++) {
+            SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+            BOOST_REQUIRE(connect(hSocket, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+            vClients.push_back(hSocket);
+        }
+        for (int nTries = 0; (int)vPeers.size() < (int)vClients.size(); nTries++) {
+            BOOST_REQUIRE(nTries < 100);
+            std::map<uint64_t, int> mapReady = WaitPeers(events, hListen, vPeers, 100);
+            if (!mapReady.count(LISTEN_ID))
+                continue;
+            SOCKET hSocket = accept(hListen, NULL, NULL);
+            if (hSocket == INVALID_SOCKET) {
+                BOOST_REQUIRE(WSAGetLastError() == WSAEWOULDBLOCK);
+                events.Drained(LISTEN_ID, CSocketEvents::EVENT_RECV);
+                continue;
+            }
+            BOOST_REQUIRE(events.CanWatch(hSocket));
+            vPeers.push_back(hSocket);
+        }
+    }
+
+    // every client sends a message, the server side reads until the socket is drained
+    for (int i = 0; i < nPeers; i++) {
+        int nMessage = i;
+        BOOST_REQUIRE(send(vClients[i], (const char*)&nMessage, sizeof(nMessage), 0) == sizeof(nMessage));
+    }
+    std::vector<int> vReceived(nPeers, -1);
+    int nReceived = 0;
+    for (int nTries = 0; nReceived < nPeers; nTries++) {
+        BOOST_REQUIRE(nTries < 1000);
+        std::map<uint64_t, int> mapReady = WaitPeers(events, hListen, vPeers, 100);
+        for (std::map<uint64_t, int>::iterator it = mapReady.begin(); it != mapReady.end(); ++it) {
+            if (it->first == LISTEN_ID)
+                continue;
+            int nPeer = it->first - 1;
+            int nMessage;
+            int nBytes = recv(vPeers[nPeer], (char*)&nMessage, sizeof(nMessage), MSG_DONTWAIT);
+            if (nBytes == sizeof(nMessage)) {
+                BOOST_CHECK_EQUAL(vReceived[nPeer], -1);
+                vReceived[nPeer] = nMessage;
+                nReceived++;
+            } else {
+                BOOST_REQUIRE(nBytes < 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+                events.Drained(it->first, CSocketEvents::EVENT_RECV);
+            }
+        }
+    }
+    for (int i = 0; i < nPeers; i++)
+        BOOST_CHECK_EQUAL(vReceived[i], i);
+
+    // report the drained sockets once more, then nothing is ready
+    std::map<uint64_t, int> mapReady = WaitPeers(events, hListen, vPeers, 0);
+    for (std::map<uint64_t, int>::iterator it = mapReady.begin(); it != mapReady.end(); ++it) {
+        if (it->first == LISTEN_ID) {
+            BOOST_CHECK(accept(hListen, NULL, NULL) == INVALID_SOCKET);
+        } else {
+            char ch;
+            BOOST_CHECK(recv(vPeers[it->first - 1], &ch, 1, MSG_DONTWAIT) < 0);
+        }
+        events.Drained(it->first, CSocketEvents::EVENT_RECV);
+    }
+    BOOST_CHECK(WaitPeers(events, hListen, vPeers, 0).empty());
+
+    BOOST_TEST_MESSAGE(strprintf("%s: %d loopback peers connected and serviced in %.2fms", events.GetBackendName(),
+        nPeers, 0.001 * (GetTimeMicros() - nStart)));
+
+    // closing a client shows up on its peer, and closed peers are forgotten
+    CloseSocket(vClients[0]);
+    mapReady = WaitPeers(events, hListen, vPeers, 1000);
+    BOOST_CHECK(mapReady.count(1));
+    char ch;
+    BOOST_CHECK_EQUAL(recv(vPeers[0], &ch, 1, MSG_DONTWAIT), 0);
+    CloseSocket(vPeers[0]);
+    BOOST_CHECK(WaitPeers(events, hListen, vPeers, 0).empty());
+
+    for (int i = 1; i < nPeers; i++) {
+        CloseSocket(vClients[i]);
+        CloseSocket(vPeers[i]);
+    }
+    CloseSocket(hListen);
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_select)
+{
+    RunLoopbackPeers(false, 200);
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_epoll)
+{
+    if (!CSocketEvents::IsEpollSupported())
+        return;
+    RunLoopbackPeers(true, 200);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,13 +6,17 @@
 
 #include "txdb.h"
 
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "random.h"
 #include "uint256.h"
 #include "accumulators.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -208,33 +212,82 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+namespace
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+/** A block index entry decoded by a loader thread, waiting to be linked into mapBlockIndex */
+struct CLoadedBlockIndex {
+    uint256 hash;
+    uint256 hashPrev;
+    uint256 hashNext;
+    CBlockIndex* pindex;
+    bool fVerified; //!< header hashed for the first time, the flag must be written back
+};
 
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair('b', uint256(0));
-    pcursor->Seek(ssKeySet.str());
+/** One slice of the 'b' key range, read and decoded by its own thread */
+class CBlockIndexLoader
+{
+public:
+    std::string strKeyBegin;
+    std::string strKeyEnd; //!< empty for the last slice
+    unsigned int nVerifyInterval; //!< rehash 1 in n entries already marked BLOCK_HASH_VERIFIED
+    unsigned int nVerifyCount;
+    std::vector<CLoadedBlockIndex> vLoaded;
+    std::string strError;
 
-    // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+    CBlockIndexLoader(leveldb::Iterator* pcursorIn) : nVerifyInterval(0), nVerifyCount(0), pcursor(pcursorIn) {}
+
+    ~CBlockIndexLoader()
+    {
+        // Entries not handed over to mapBlockIndex are still owned here
+        BOOST_FOREACH (CLoadedBlockIndex& loaded, vLoaded)
+            delete loaded.pindex;
+    }
+
+    void Load()
+    {
         try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
+            for (pcursor->Seek(strKeyBegin); pcursor->Valid(); pcursor->Next()) {
+                leveldb::Slice slKey = pcursor->key();
+                if (!strKeyEnd.empty() && slKey.compare(strKeyEnd) >= 0)
+                    break;
+                if (slKey.size() == 0 || slKey[0] != 'b')
+                    break;
+                if (ShutdownRequested()) {
+                    strError = "shutdown requested";
+                    return;
+                }
+
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                CLoadedBlockIndex loaded;
+                ssKey >> chType >> loaded.hash;
+
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
+                loaded.hashPrev = diskindex.hashPrev;
+                loaded.hashNext = diskindex.hashNext;
+
+                // Hashing a Quark header dominates loading, so an entry that was checked against
+                // its key once is trusted from then on, apart from a sample that is rehashed
+                loaded.fVerified = !(diskindex.nStatus & BLOCK_HASH_VERIFIED);
+                if (loaded.fVerified || (nVerifyInterval > 0 && ++nVerifyCount % nVerifyInterval == 0)) {
+                    if (diskindex.GetHeaderHash() != loaded.hash) {
+                        strError = strprintf("block index entry %s does not match its header at height %d", loaded.hash.GetHex(), diskindex.nHeight);
+                        return;
+                    }
+                    diskindex.nStatus |= BLOCK_HASH_VERIFIED;
+                }
 
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
+                if (diskindex.nHeight <= Params().LAST_POW_BLOCK()) {
+                    if (!CheckProofOfWork(loaded.hash, diskindex.nBits)) {
+                        strError = strprintf("CheckProofOfWork failed: block %s at height %d", loaded.hash.GetHex(), diskindex.nHeight);
+                        return;
+                    }
+                }
+
+                CBlockIndex* pindexNew = new CBlockIndex();
                 pindexNew->nHeight = diskindex.nHeight;
                 pindexNew->nFile = diskindex.nFile;
                 pindexNew->nDataPos = diskindex.nDataPos;
@@ -249,8 +302,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
                 //zerocoin
                 pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
+                pindexNew->zerocoinSupply = diskindex.zerocoinSupply;
+                pindexNew->mintDenominations = diskindex.mintDenominations;
 
                 //Proof Of Stake
                 pindexNew->nMint = diskindex.nMint;
@@ -259,34 +312,134 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nStakeModifier = diskindex.nStakeModifier;
                 pindexNew->prevoutStake = diskindex.prevoutStake;
                 pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
 
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                // ppcoin: build setStakeSeen
-                if (pindexNew->IsProofOfStake())
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+                loaded.pindex = pindexNew;
+                vLoaded.push_back(loaded);
+            }
+            if (!pcursor->status().ok())
+                strError = pcursor->status().ToString();
+        } catch (std::exception& e) {
+            strError = strprintf("Deserialize or I/O error - %s", e.what());
+        }
+    }
 
-                //populate accumulator checksum map in memory
-                if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
-                    //Don't load any checkpoints that exist before v2 zdeq. The accumulator is invalid for v1 and not used.
-                    if (pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
-                        LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
+private:
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+};
 
-                    nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
-                }
+std::string BlockIndexKey(unsigned char chFirstByte)
+{
+    uint256 hash;
+    *hash.begin() = chFirstByte;
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair('b', hash);
+    return ssKey.str();
+}
+} // anon namespace
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Split the key range by the first byte of the block hash and read every slice on its own
+    // thread with its own iterator. Block hashes are uniformly distributed, so the slices are
+    // about the same size.
+    int nThreads = boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_BLOCK_INDEX_LOAD_THREADS));
+    unsigned int nVerifyInterval = std::max((int64_t)0, GetArg("-verifyblockhashes", DEFAULT_VERIFY_BLOCK_HASHES));
+
+    std::vector<boost::shared_ptr<CBlockIndexLoader> > vLoaders;
+    for (int i = 0; i < nThreads; i++) {
+        boost::shared_ptr<CBlockIndexLoader> loader(new CBlockIndexLoader(NewIterator()));
+        loader->nVerifyInterval = nVerifyInterval;
+        if (nVerifyInterval > 1)
+            loader->nVerifyCount = GetRand(nVerifyInterval);
+        loader->strKeyBegin = BlockIndexKey(256 * i / nThreads);
+        if (i + 1 < nThreads)
+            loader->strKeyEnd = BlockIndexKey(256 * (i + 1) / nThreads);
+        vLoaders.push_back(loader);
+    }
+    if (nThreads == 1) {
+        vLoaders[0]->Load();
+    } else {
+        boost::thread_group threadGroup;
+        BOOST_FOREACH (boost::shared_ptr<CBlockIndexLoader>& loader, vLoaders)
+            threadGroup.create_thread(boost::bind(&CBlockIndexLoader::Load, loader.get()));
+        threadGroup.join_all();
+    }
+
+    size_t nLoaded = 0;
+    BOOST_FOREACH (const boost::shared_ptr<CBlockIndexLoader>& loader, vLoaders) {
+        if (!loader->strError.empty())
+            return error("%s : %s", __func__, loader->strError);
+        nLoaded += loader->vLoaded.size();
+    }
+    int64_t nTimeRead = GetTimeMicros();
+    LogPrint("bench", "    - Read %u block index entries on %d threads: %.2fms\n", nLoaded, nThreads, 0.001 * (nTimeRead - nTimeStart));
+
+    boost::this_thread::interruption_point();
+
+    // Hand the entries over to mapBlockIndex before linking, so that pprev and pnext
+    // resolve to the loaded objects instead of creating placeholders
+    mapBlockIndex.reserve(mapBlockIndex.size() + nLoaded);
+    BOOST_FOREACH (boost::shared_ptr<CBlockIndexLoader>& loader, vLoaders) {
+        BOOST_FOREACH (CLoadedBlockIndex& loaded, loader->vLoaded) {
+            std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(loaded.hash, loaded.pindex));
+            if (!ret.second) {
+                // Already referenced by an earlier entry
+                *ret.first->second = *loaded.pindex;
+                delete loaded.pindex;
+                loaded.pindex = ret.first->second;
             }
-        } catch (std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            loaded.pindex->phashBlock = &ret.first->first;
         }
     }
 
+    std::set<uint256> setCheckpoints;
+    std::vector<CBlockIndex*> vVerified;
+    BOOST_FOREACH (boost::shared_ptr<CBlockIndexLoader>& loader, vLoaders) {
+        BOOST_FOREACH (const CLoadedBlockIndex& loaded, loader->vLoaded) {
+            CBlockIndex* pindexNew = loaded.pindex;
+            pindexNew->pprev = InsertBlockIndex(loaded.hashPrev);
+            pindexNew->pnext = InsertBlockIndex(loaded.hashNext);
+
+            // ppcoin: build setStakeSeen
+            if (pindexNew->IsProofOfStake())
+                setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+            //Don't load any checkpoints that exist before v2 zdeq. The accumulator is invalid for v1 and not used.
+            if (pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
+                setCheckpoints.insert(pindexNew->nAccumulatorCheckpoint);
+
+            if (loaded.fVerified)
+                vVerified.push_back(pindexNew);
+        }
+        // mapBlockIndex owns the entries now
+        loader->vLoaded.clear();
+    }
+    int64_t nTimeLink = GetTimeMicros();
+    LogPrint("bench", "    - Link block index: %.2fms\n", 0.001 * (nTimeLink - nTimeRead));
+
+    // Persist BLOCK_HASH_VERIFIED for entries written before it existed, so that the next
+    // startup can skip hashing them
+    if (!vVerified.empty()) {
+        LogPrintf("%s : marking %u block index entries as verified\n", __func__, vVerified.size());
+        for (size_t i = 0; i < vVerified.size();) {
+            CLevelDBBatch batch;
+            for (size_t n = 0; n < 10000 && i < vVerified.size(); n++, i++)
+                batch.Write(make_pair('b', vVerified[i]->GetBlockHash()), CDiskBlockIndex(vVerified[i]));
+            if (!WriteBatch(batch))
+                return error("%s : failed to write block index", __func__);
+        }
+    }
+
+    boost::this_thread::interruption_point();
+
+    //populate accumulator checksum map in memory, once per distinct checkpoint
+    BOOST_FOREACH (const uint256& nCheckpoint, setCheckpoints)
+        LoadAccumulatorValuesFromDB(nCheckpoint);
+    LogPrint("bench", "    - Load %u accumulator checkpoints: %.2fms\n", setCheckpoints.size(), 0.001 * (GetTimeMicros() - nTimeLink));
+
     return true;
 }
 
@@ -16,6 +16,7 @@ struct CBlockLocator;
 class CBlockIndex;
 class CReserveScript;
 class CTransaction;
+class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
 class uint256;
@@ -36,6 +37,8 @@ protected:
 // XX42    virtual void EraseFromWallet(const uint256& hash){};
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
+    virtual void TransactionAddedToMempool(const CTransaction &tx) {}
+    virtual void TransactionRemovedFromMempool(const CTransaction &tx) {}
     virtual void NotifyTransactionLock(const CTransaction &tx) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual bool UpdatedTransaction(const uint256 &hash) { return false;}
@@ -56,6 +59,10 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of a transaction entering the memory pool. */
+    boost::signals2::signal<void (const CTransaction &)> TransactionAddedToMempool;
+    /** Notifies listeners of a transaction leaving the memory pool, for whatever reason. */
+    boost::signals2::signal<void (const CTransaction &)> TransactionRemovedFromMempool;
     /** Notifies listeners of an updated transaction lock without new data. */
     boost::signals2::signal<void (const CTransaction &)> NotifyTransactionLock;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
@@ -73,6 +80,14 @@ struct CMainSignals {
 // XX42    boost::signals2::signal<void (boost::shared_ptr<CReserveScript>&)> ScriptForMining;
     /** Notifies listeners that a block has been successfully mined */
     boost::signals2::signal<void (const uint256 &)> BlockFound;
+
+    /** Forward the entry notifications of a memory pool to the listeners */
+    void RegisterWithMempoolSignals(CTxMemPool& pool);
+    void UnregisterWithMempoolSignals(CTxMemPool& pool);
+
+private:
+    void MempoolEntryAdded(const CTransaction &tx);
+    void MempoolEntryRemoved(const CTransaction &tx);
 };
 
 CMainSignals& GetMainSignals();
@@ -13,7 +13,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 90003;
+static const int PROTOCOL_VERSION = 90004;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -21,6 +21,9 @@ static const int INIT_PROTO_VERSION = 209;
 //! In this version, 'getheaders' was introduced.
 static const int GETHEADERS_VERSION = 70077;
 
+//! 'getheaders' is answered with 'headers', and blocks are synced headers-first, starting with this version
+static const int HEADERS_FIRST_VERSION = 90004;
+
 //! disconnect from peers older than this proto version
 static const int MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT = 90002;
 static const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 90003;
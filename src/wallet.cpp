@@ -726,7 +726,18 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             // Get merkle branch if transaction was found in a block
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
-            return AddToWallet(wtx);
+            if (!AddToWallet(wtx))
+                return false;
+
+            // The outputs of this transaction and the ones it spends may have changed stakeability
+            UpdateStakeableOutputs(wtx.GetHash());
+            if (!tx.IsZerocoinSpend()) {
+                BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+                    if (mapWallet.count(txin.prevout.hash))
+                        UpdateStakeableOutputs(txin.prevout.hash);
+                }
+            }
+            return true;
         }
     }
     return false;
@@ -755,10 +766,70 @@ void CWallet::EraseFromWallet(const uint256& hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        UpdateStakeableOutputs(hash);
     }
     return;
 }
 
+/**
+ * Bring the stakeable output index up to date for one wallet transaction. Depth,
+ * maturity and age change with every block, so they are left to SelectStakeCoins().
+ */
+void CWallet::UpdateStakeableOutputs(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fStakeableOutputsLoaded)
+        return;
+
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end()) {
+        // The transaction left the wallet, don't keep pointers to it
+        map<COutPoint, CStakeableOutput>::iterator it = mapStakeableOutputs.lower_bound(COutPoint(hash, 0));
+        while (it != mapStakeableOutputs.end() && it->first.hash == hash)
+            mapStakeableOutputs.erase(it++);
+        return;
+    }
+
+    AssertLockHeld(cs_main); // IsSpent
+    const CWalletTx& wtx = mi->second;
+    bool fInBlock = wtx.hashBlock != 0 && wtx.nIndex != -1;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        const CTxOut& txout = wtx.vout[i];
+        const COutPoint outpoint(hash, i);
+        isminetype mine = IsMine(txout);
+        if (!fInBlock || txout.nValue <= 0 || txout.IsZerocoinMint() ||
+            mine == ISMINE_NO || mine == ISMINE_WATCH_ONLY || IsSpent(hash, i)) {
+            mapStakeableOutputs.erase(outpoint);
+            continue;
+        }
+
+        // Keep the chain data already resolved unless the transaction moved to another block
+        map<COutPoint, CStakeableOutput>::iterator it = mapStakeableOutputs.find(outpoint);
+        if (it != mapStakeableOutputs.end() && it->second.hashBlock == wtx.hashBlock)
+            continue;
+        if (it != mapStakeableOutputs.end())
+            mapStakeableOutputs.erase(it);
+
+        CStakeableOutput out(&wtx, i, wtx.hashBlock);
+        out.fLocked = IsLockedCoin(hash, i);
+        mapStakeableOutputs.insert(make_pair(outpoint, out));
+    }
+}
+
+void CWallet::LoadStakeableOutputs()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    int64_t nStart = GetTimeMillis();
+    mapStakeableOutputs.clear();
+    fStakeableOutputsLoaded = true;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateStakeableOutputs(it->first);
+
+    LogPrint("selectcoins", "%s : %u stakeable outputs indexed in %dms\n", __func__, mapStakeableOutputs.size(), GetTimeMillis() - nStart);
+}
+
 
 isminetype CWallet::IsMine(const CTxIn& txin) const
 {
@@ -2089,38 +2160,65 @@ bool less_then_denom(const COutput& out1, const COutput& out2)
 
 bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_wallet);
+    if (!fStakeableOutputsLoaded)
+        LoadStakeableOutputs();
+
     //Add DEQ
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
     CAmount nAmountSelected = 0;
     if (GetBoolArg("-DEQstake", true)) {
-        for (const COutput &out : vCoins) {
+        for (std::pair<const COutPoint, CStakeableOutput>& item : mapStakeableOutputs) {
+            CStakeableOutput& out = item.second;
+            if (out.fLocked)
+                continue;
+
             //make sure not to outrun target amount
-            if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+            CAmount nValue = out.tx->vout[out.i].nValue;
+            if (nAmountSelected + nValue > nTargetAmount)
                 continue;
 
-            //if zerocoinspend, then use the block time
-            int64_t nTxTime = out.tx->GetTxTime();
-            if (out.tx->IsZerocoinSpend()) {
-                if (!out.tx->IsInMainChain())
+            //the output has to be in the active chain
+            if (!out.pindexFrom) {
+                BlockMap::iterator mi = mapBlockIndex.find(out.hashBlock);
+                if (mi == mapBlockIndex.end() || !mi->second)
                     continue;
-                nTxTime = mapBlockIndex.at(out.tx->hashBlock)->GetBlockTime();
+                out.pindexFrom = mi->second;
+                out.nTimeBlockFrom = out.pindexFrom->GetBlockTime();
             }
+            if (!chainActive.Contains(out.pindexFrom))
+                continue;
+            int nDepth = chainActive.Height() - out.pindexFrom->nHeight + 1;
+
+            //if zerocoinspend, then use the block time
+            int64_t nTxTime = out.tx->IsZerocoinSpend() ? out.nTimeBlockFrom : out.tx->GetTxTime();
 
             //check for min age
             if (GetAdjustedTime() - nTxTime < nStakeMinAge)
                 continue;
 
-            //check that it is matured
-            if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
+            //check that it is matured, including coinbase/coinstake maturity
+            int nMinDepth = out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10;
+            if (out.tx->IsCoinBase() || out.tx->IsCoinStake())
+                nMinDepth = std::max(nMinDepth, Params().COINBASE_MATURITY() + 1);
+            if (nDepth < nMinDepth)
                 continue;
 
+            //reuse the stake modifier as long as the blocks it was taken from are active
+            if (!out.pindexStakeModifier || !chainActive.Contains(out.pindexStakeModifier)) {
+                int nStakeModifierHeight = 0;
+                int64_t nStakeModifierTime = 0;
+                out.pindexStakeModifier = NULL;
+                if (!GetKernelStakeModifier(out.hashBlock, out.nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+                    continue;
+                out.pindexStakeModifier = chainActive[nStakeModifierHeight];
+            }
+
             //add to our stake set
-            nAmountSelected += out.tx->vout[out.i].nValue;
+            nAmountSelected += nValue;
 
             std::unique_ptr<CDEQStake> input(new CDEQStake());
             input->SetInput((CTransaction) *out.tx, out.i);
+            input->SetIndexFrom(out.pindexFrom, out.nStakeModifier);
             listInputs.emplace_back(std::move(input));
         }
     }
@@ -2947,9 +3045,11 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (GetAdjustedTime() - chainActive.Tip()->GetBlockTime() < 60)
         MilliSleep(10000);
 
-    CAmount nCredit = 0;
-    CScript scriptPubKeyKernel;
-    bool fKernelFound = false;
+    // Compute what the kernel hash needs from each input once, before any timestamp is hashed
+    std::vector<CStakeKernelInput> vKernelInputs;
+    std::vector<CStakeInput*> vKernelStakeInputs;
+    vKernelInputs.reserve(listInputs.size());
+    vKernelStakeInputs.reserve(listInputs.size());
     for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
         // Make sure the wallet is unlocked and shutdown hasn't been requested
         if (IsLocked() || ShutdownRequested())
@@ -2962,13 +3062,30 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             continue;
         }
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-        uint256 hashProofOfStake = 0;
-        nTxNewTime = GetAdjustedTime();
+        CStakeKernelInput kernelInput;
+        if (!kernelInput.SetInput(stakeInput.get(), pindex->GetBlockTime()))
+            continue;
+        vKernelInputs.push_back(kernelInput);
+        vKernelStakeInputs.push_back(stakeInput.get());
+    }
+
+    CAmount nCredit = 0;
+    CScript scriptPubKeyKernel;
+    bool fKernelFound = false;
+    unsigned int nTimeTxSearch = GetAdjustedTime();
+    size_t nKernelStart = 0;
+    size_t nKernelFound = 0;
+    uint256 hashProofOfStake = 0;
+    //iterates each utxo inside of FindStakeKernel(), resuming after kernels that can't be used
+    while (FindStakeKernel(vKernelInputs, nKernelStart, nBits, nTimeTxSearch, nKernelFound, nTxNewTime, hashProofOfStake)) {
+        nKernelStart = nKernelFound + 1;
+        CStakeInput* stakeInput = vKernelStakeInputs[nKernelFound];
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (Stake(stakeInput.get(), nBits, block.GetBlockTime(), nTxNewTime, hashProofOfStake)) {
+        // Make sure the wallet is unlocked and shutdown hasn't been requested
+        if (IsLocked() || ShutdownRequested())
+            return false;
+
+        {
             LOCK(cs_main);
             //Double check that this will pass time requirements
             if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
@@ -3024,7 +3141,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
             //Mark mints as spent
             if (stakeInput->IsZDEQ()) {
-                CZDEQStake* z = (CZDEQStake*)stakeInput.get();
+                CZDEQStake* z = (CZDEQStake*)stakeInput;
                 if (!z->MarkSpent(this, txNew.GetHash()))
                     return error("%s: failed to mark mint as used\n", __func__);
             }
@@ -3748,17 +3865,30 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+
+    map<COutPoint, CStakeableOutput>::iterator it = mapStakeableOutputs.find(output);
+    if (it != mapStakeableOutputs.end())
+        it->second.fLocked = true;
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+
+    map<COutPoint, CStakeableOutput>::iterator it = mapStakeableOutputs.find(output);
+    if (it != mapStakeableOutputs.end())
+        it->second.fLocked = false;
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    BOOST_FOREACH (const COutPoint& output, setLockedCoins) {
+        map<COutPoint, CStakeableOutput>::iterator it = mapStakeableOutputs.find(output);
+        if (it != mapStakeableOutputs.end())
+            it->second.fLocked = false;
+    }
     setLockedCoins.clear();
 }
 
@@ -160,6 +160,39 @@ public:
     StringMap destdata;
 };
 
+/**
+ * A wallet output that may be used as a stake input, with the chain data its kernel
+ * needs. Kept up to date by the wallet so a staking round does not scan mapWallet.
+ */
+class CStakeableOutput
+{
+public:
+    const CWalletTx* tx;
+    unsigned int i;
+    uint256 hashBlock;
+    bool fLocked;
+
+    //! resolved on first use; reset when the transaction moves to another block
+    CBlockIndex* pindexFrom;
+    unsigned int nTimeBlockFrom;
+
+    //! cached stake modifier, valid while pindexStakeModifier is in the active chain
+    uint64_t nStakeModifier;
+    const CBlockIndex* pindexStakeModifier;
+
+    CStakeableOutput(const CWalletTx* txIn, unsigned int iIn, const uint256& hashBlockIn)
+    {
+        tx = txIn;
+        i = iIn;
+        hashBlock = hashBlockIn;
+        fLocked = false;
+        pindexFrom = NULL;
+        nTimeBlockFrom = 0;
+        nStakeModifier = 0;
+        pindexStakeModifier = NULL;
+    }
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -193,6 +226,16 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Index of the outputs SelectStakeCoins() may pick from, filled on the first staking
+     * round and then maintained from AddToWalletIfInvolvingMe(), EraseFromWallet() and
+     * the coin lock functions. Protected by cs_wallet.
+     */
+    std::map<COutPoint, CStakeableOutput> mapStakeableOutputs;
+    bool fStakeableOutputsLoaded;
+    void UpdateStakeableOutputs(const uint256& hash);
+    void LoadStakeableOutputs();
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount);
@@ -304,6 +347,7 @@ public:
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
+        fStakeableOutputsLoaded = false;
 
         // Stake Settings
         nHashDrift = 45;
@@ -0,0 +1,114 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zdeqspendcache.h"
+
+#include "hash.h"
+#include "random.h"
+#include "util.h"
+#include "libzerocoin/CoinSpend.h"
+
+#include <atomic>
+#include <set>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Valid zerocoin spend cache, to avoid doing the expensive bignum proof checks
+ * twice for every spend (once when accepted into memory pool, and again when
+ * accepted into the block chain)
+ */
+class CZerocoinSpendCache
+{
+private:
+    //! Per-process salt, so that peers cannot predict which entries collide or get evicted
+    uint256 salt;
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_spendcache;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CZerocoinSpendCache() : salt(GetRandHash()), nHits(0), nMisses(0) {}
+
+    uint256 ComputeKey(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* params, const CBigNum& bnAccumulatorValue)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << salt << spend << spend.getAccumulatorChecksum() << spend.getTxOutHash();
+        ss << params->accumulatorParams.accumulatorModulus << bnAccumulatorValue;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& key)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        if (setValid.count(key)) {
+            ++nHits;
+            return true;
+        }
+        ++nMisses;
+        return false;
+    }
+
+    void Set(const uint256& key)
+    {
+        // Every entry is a single hash, so even the default limit stays well below 1MB
+        int64_t nMaxCacheSize = GetArg("-maxzerocoinspendcachesize", 20000);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, like the signature cache does
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(key);
+    }
+
+    ZerocoinSpendCacheStats GetStats()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        ZerocoinSpendCacheStats stats;
+        stats.nSize = setValid.size();
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        return stats;
+    }
+};
+
+CZerocoinSpendCache& SpendCache()
+{
+    static CZerocoinSpendCache spendCache;
+    return spendCache;
+}
+
+}
+
+uint256 GetZerocoinSpendCacheKey(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* params, const CBigNum& bnAccumulatorValue)
+{
+    return SpendCache().ComputeKey(spend, params, bnAccumulatorValue);
+}
+
+bool IsZerocoinSpendVerified(const uint256& key)
+{
+    return SpendCache().Get(key);
+}
+
+void SetZerocoinSpendVerified(const uint256& key)
+{
+    SpendCache().Set(key);
+}
+
+ZerocoinSpendCacheStats GetZerocoinSpendCacheStats()
+{
+    return SpendCache().GetStats();
+}
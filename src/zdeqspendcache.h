@@ -0,0 +1,42 @@
+// Copyright (c) 2018-2021 The Dequant developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef Dequant_ZDEQSPENDCACHE_H
+#define Dequant_ZDEQSPENDCACHE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+
+class CBigNum;
+
+namespace libzerocoin
+{
+class CoinSpend;
+class ZerocoinParams;
+}
+
+/** Lookup statistics of the verified zerocoin spend cache */
+struct ZerocoinSpendCacheStats {
+    uint64_t nSize;
+    uint64_t nHits;
+    uint64_t nMisses;
+};
+
+/**
+ * Salted key under which a successful spend verification is remembered. It commits to the whole
+ * serialized spend (which contains the txout hash and accumulator checksum it signs) and to the
+ * parameters and accumulator value the proofs were checked against.
+ */
+uint256 GetZerocoinSpendCacheKey(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* params, const CBigNum& bnAccumulatorValue);
+
+/** Whether a spend with this key already passed CoinSpend::Verify */
+bool IsZerocoinSpendVerified(const uint256& key);
+
+/** Remember that the spend with this key passed CoinSpend::Verify */
+void SetZerocoinSpendVerified(const uint256& key);
+
+ZerocoinSpendCacheStats GetZerocoinSpendCacheStats();
+
+#endif //Dequant_ZDEQSPENDCACHE_H